@@ -0,0 +1,74 @@
+#!/bin/sh
+# Flash, RAM, stack and cycle budget of every configuration of the PowerMeter sketch.
+# Compiles each combination of the sketch's compile time options with arduino-cli,
+# sizes it with avr-size, and runs it under simavr with pmbudget. The table goes to
+# stdout and to out/budget.txt. The previous run's table is kept as out/budget.prev.txt,
+# and rows that changed are shown with the change.
+#
+# usage: budget.sh [seconds per pmbudget phase]
+#   FQBN defaults to the 5V 16MHz Pro Mini. ARDUINO_CLI, AVR_SIZE override the tools.
+set -e
+
+cd "$(dirname "$0")"
+SECONDS_PER_PHASE=${1:-1}
+FQBN=${FQBN:-arduino:avr:pro:cpu=16MHzatmega328}
+ARDUINO_CLI=${ARDUINO_CLI:-arduino-cli}
+AVR_SIZE=${AVR_SIZE:-avr-size}
+FLASH_MAX=30720 # less the boot loader
+RAM_MAX=2048
+OUT=out
+for tool in "$ARDUINO_CLI" "$AVR_SIZE" ./pmbudget; do
+    command -v "$tool" >/dev/null 2>&1 || { echo "budget.sh: $tool not found. See ReadMe.md" >&2; exit 1; }
+done
+mkdir -p $OUT
+
+# compile <name> <defines>: out/<name>/PowerMeter.ino.elf
+compile() {
+    $ARDUINO_CLI compile --fqbn "$FQBN" --build-path "$OUT/build-$1" --output-dir "$OUT/$1" \
+        --build-property "compiler.cpp.extra_flags=$2" ../PowerMeter >"$OUT/$1.log" 2>&1 ||
+        { cat "$OUT/$1.log" >&2; exit 1; }
+}
+
+table=$OUT/budget.txt.new
+printf '%-57s %6s %4s %5s %5s %5s %7s %7s %8s %7s\n' \
+    configuration flash '%' ram stack free loop sample display comm >$table
+for coupler in OEM_COUPLER W5XD_COUPLER; do
+for scales in OEM_METER_SCALES CUSTOM_METER_SCALES; do
+for leds in LEDS_ARE_RGB LEDS_ARE_RGY; do
+for wdt in "" SUPPORT_WDT; do
+    name=$coupler,$scales,$leds${wdt:+,$wdt}
+    defines="-D$coupler -D$scales -D$leds${wdt:+ -D$wdt}"
+    # sizes without the markers, which add an OUT instruction each
+    compile "$name" "$defines"
+    compile "$name,markers" "$defines -DBUDGET_MARKERS"
+    set -- $($AVR_SIZE "$OUT/$name/PowerMeter.ino.elf" | awk 'NR == 2 { print $1, $2, $3 }')
+    flash=$(($1 + $2))
+    ram=$(($2 + $3))
+    # stack=N loop=N loop_count=N ... The assignment, unlike eval "$(...)", stops on a failed run
+    result=$(./pmbudget -s "$SECONDS_PER_PHASE" "$OUT/$name,markers/PowerMeter.ino.elf")
+    eval "$result"
+    printf '%-57s %6u %4u %5u %5u %5d %7u %7u %8u %7u\n' \
+        "$name" $flash $((flash * 100 / FLASH_MAX)) $ram $stack $((RAM_MAX - ram - stack)) \
+        $loop $sample $display $comm >>$table
+done
+done
+done
+done
+
+[ -f $OUT/budget.txt ] && mv $OUT/budget.txt $OUT/budget.prev.txt
+mv $table $OUT/budget.txt
+echo "bytes of flash and RAM; cycles at 16MHz, worst case, for loop(), sample(), the 125 msec display update and the comm update"
+if [ -f $OUT/budget.prev.txt ]; then
+    # each number that changed is shown as new(+change)
+    awk 'NR == FNR { prev[$1] = $0; next }
+        FNR == 1 || !($1 in prev) { print; next }
+        {
+            split(prev[$1], p)
+            line = sprintf("%-57s", $1)
+            for (i = 2; i <= NF; i++)
+                line = line " " ($i == p[i] ? $i : sprintf("%s(%+d)", $i, $i - p[i]))
+            print line
+        }' $OUT/budget.prev.txt $OUT/budget.txt
+else
+    cat $OUT/budget.txt
+fi
@@ -0,0 +1,298 @@
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sim_avr.h>
+#include <sim_elf.h>
+#include <sim_irq.h>
+#include <sim_cycle_timers.h>
+#include <sim_time.h>
+#include <avr_adc.h>
+#include <avr_ioport.h>
+#include <avr_twi.h>
+#include <avr_uart.h>
+
+/* pmbudget
+** Runs a PowerMeter.ino.elf built with -DBUDGET_MARKERS under simavr, as the ATmega328P
+** at 16MHz on the PCB, and reports the worst case cycles between each BUDGET_BEGIN and
+** BUDGET_END in the sketch, and the deepest the stack went.
+** usage: pmbudget [-s seconds] <elf>
+**      -s  simulated seconds per phase. Default 1
+** The coupler voltages are synthetic. Each phase holds the front panel switch at one
+** position while the coupler is keyed like CW at 13 WPM, first within the undivided
+** ADC inputs, then above them so sample() takes its divided input path. The serial port
+** turns on P PEAK and every SUB stream, so the comm update does the most it can.
+** The TLC59108 LED drivers are an I2C slave that acknowledges everything.
+** One line of output, key=value, for budget.sh. */
+
+namespace {
+    enum { BUDGET_LOOP = 1, BUDGET_SAMPLE, BUDGET_DISPLAY, BUDGET_COMM, NUM_MARKERS }; // as in PowerMeter.ino
+    const char *const MarkerNames[NUM_MARKERS] = { "", "loop", "sample", "display", "comm" };
+
+    const uint32_t CPU_HZ = 16000000;
+    const avr_io_addr_t GPIOR0_ADDR = 0x3E; // data space address of I/O register 0x1E
+    const uint16_t RAMEND = 0x8FF;
+
+    // Arduino pins on the PCB, per the sketch's pin assignments
+    const int ADC_FWD_LOW = 0; // A0
+    const int ADC_REV_UNDIVIDED = 1; // A1
+    const int ADC_FWD_UNDIVIDED = 2; // A2
+    const int ADC_HOLD_POT = 3; // A3
+    const int ADC_REV_LOW = 7; // A7
+    const int PD_COUPLER_DETECT = 2; // D2, low with RF
+    const int PD_CALIBRATE = 3; // D3, low to calibrate
+    const int PD_ALO_SWITCH = 4; // D4
+    const int PD_FWD_SWITCH = 5; // D5
+    const int PD_SP3T_2 = 6; // D6
+    const int PD_SP3T_1 = 7; // D7
+
+    struct Marker
+    {
+        bool started;
+        avr_cycle_count_t start;
+        avr_cycle_count_t worst;
+        unsigned long count;
+    };
+
+    struct Harness
+    {
+        avr_t *avr;
+        Marker markers[NUM_MARKERS];
+        avr_irq_t *twiIrq;
+        uint8_t twiSelected;
+        std::string toSend; // on the serial port, a byte at a time
+        size_t sent;
+        uint16_t forwardMv; // at the undivided inputs while keyed
+        uint16_t reverseMv;
+        bool keyed;
+    };
+
+    void OnMarker(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param)
+    {
+        Harness &h = *static_cast<Harness *>(param);
+        avr->data[addr] = v;
+        uint8_t id = v & 0x7F;
+        if (id == 0 || id >= NUM_MARKERS)
+            return;
+        Marker &m = h.markers[id];
+        if ((v & 0x80) == 0)
+        {   // a BEGIN without its END, as when loop() returns early, is not counted
+            m.started = true;
+            m.start = avr->cycle;
+        }
+        else if (m.started)
+        {
+            avr_cycle_count_t c = avr->cycle - m.start;
+            if (c > m.worst)
+                m.worst = c;
+            m.count += 1;
+            m.started = false;
+        }
+    }
+
+    // an I2C slave at every address, that acknowledges everything and reads as zero
+    void OnTwi(avr_irq_t *, uint32_t value, void *param)
+    {
+        Harness &h = *static_cast<Harness *>(param);
+        avr_twi_msg_irq_t v;
+        v.u.v = value;
+        if (v.u.twi.msg & TWI_COND_STOP)
+            h.twiSelected = 0;
+        if (v.u.twi.msg & TWI_COND_ADDR)
+        {
+            h.twiSelected = v.u.twi.addr;
+            avr_raise_irq(h.twiIrq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, h.twiSelected, 1));
+        }
+        if (h.twiSelected)
+        {
+            if (v.u.twi.msg & TWI_COND_WRITE)
+                avr_raise_irq(h.twiIrq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, h.twiSelected, 1));
+            if (v.u.twi.msg & TWI_COND_READ)
+                avr_raise_irq(h.twiIrq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_READ, h.twiSelected, 0));
+        }
+    }
+
+    void SetPin(avr_t *avr, char port, int pin, bool high)
+    {
+        avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(port), pin), high ? 1 : 0);
+    }
+
+    void SetAdc(avr_t *avr, int channel, uint32_t mv)
+    {
+        avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0 + channel), mv);
+    }
+
+    // the coupler's divided inputs see (15/115) of what would be at the undivided ones.
+    // Close enough for either coupler's divider, as only the code path matters here
+    void ApplyCoupler(Harness &h)
+    {
+        uint32_t f = h.keyed ? h.forwardMv : 0;
+        uint32_t r = h.keyed ? h.reverseMv : 0;
+        SetAdc(h.avr, ADC_FWD_UNDIVIDED, f > 5000 ? 5000 : f);
+        SetAdc(h.avr, ADC_REV_UNDIVIDED, r > 5000 ? 5000 : r);
+        SetAdc(h.avr, ADC_FWD_LOW, f * 15 / 115);
+        SetAdc(h.avr, ADC_REV_LOW, r * 15 / 115);
+        SetPin(h.avr, 'D', PD_COUPLER_DETECT, !h.keyed);
+    }
+
+    const uint32_t DOT_USEC = 92000; // 13 WPM
+    avr_cycle_count_t OnKey(avr_t *avr, avr_cycle_count_t when, void *param)
+    {
+        Harness &h = *static_cast<Harness *>(param);
+        h.keyed = !h.keyed;
+        ApplyCoupler(h);
+        return when + avr_usec_to_cycles(avr, DOT_USEC);
+    }
+
+    const uint32_t BYTE_USEC = 1000; // slower than 38400 baud, so nothing is dropped
+    avr_cycle_count_t OnSerial(avr_t *avr, avr_cycle_count_t when, void *param)
+    {
+        Harness &h = *static_cast<Harness *>(param);
+        if (h.sent >= h.toSend.size())
+            return 0;
+        avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT),
+            static_cast<uint8_t>(h.toSend[h.sent++]));
+        return when + avr_usec_to_cycles(avr, BYTE_USEC);
+    }
+
+    void Send(Harness &h, const char *s)
+    {
+        h.toSend.erase(0, h.sent);
+        h.sent = 0;
+        bool idle = h.toSend.empty();
+        h.toSend += s;
+        if (idle)
+            avr_cycle_timer_register_usec(h.avr, BYTE_USEC, OnSerial, &h);
+    }
+
+    uint16_t StackPointer(const avr_t *avr)
+    {
+        return avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+    }
+
+    void Usage()
+    {
+        std::fprintf(stderr, "usage: pmbudget [-s seconds] <elf>\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = 1;
+    const char *elf = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            seconds = std::atof(argv[++i]);
+        else if (argv[i][0] != '-' && elf == nullptr)
+            elf = argv[i];
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+    if (elf == nullptr || seconds <= 0)
+    {
+        Usage();
+        return 2;
+    }
+
+    elf_firmware_t fw;
+    std::memset(&fw, 0, sizeof(fw));
+    if (elf_read_firmware(elf, &fw) != 0)
+    {
+        std::fprintf(stderr, "pmbudget: can't read %s\n", elf);
+        return 1;
+    }
+    avr_t *avr = avr_make_mcu_by_name("atmega328p");
+    if (avr == nullptr)
+    {
+        std::fprintf(stderr, "pmbudget: simavr has no atmega328p\n");
+        return 1;
+    }
+    avr_init(avr);
+    avr_load_firmware(avr, &fw);
+    avr->frequency = CPU_HZ;
+    avr->vcc = avr->avcc = avr->aref = 5000; // analogReference(DEFAULT) is Vcc
+    avr->log = LOG_NONE;
+
+    static Harness h;
+    h.avr = avr;
+    h.forwardMv = 3000;
+    h.reverseMv = 600;
+    avr_register_io_write(avr, GPIOR0_ADDR, OnMarker, &h);
+
+    uint32_t uartFlags = 0;
+    avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &uartFlags);
+    uartFlags &= ~AVR_UART_FLAG_STDIO; // the sketch's output is not wanted here
+    avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &uartFlags);
+
+    static const char *twiNames[] = { "twi.in", "twi.out" };
+    h.twiIrq = avr_alloc_irq(&avr->irq_pool, 0, 2, twiNames);
+    avr_connect_irq(h.twiIrq + TWI_IRQ_INPUT, avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_INPUT));
+    avr_connect_irq(avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_OUTPUT), h.twiIrq + TWI_IRQ_OUTPUT);
+    avr_irq_register_notify(h.twiIrq + TWI_IRQ_OUTPUT, OnTwi, &h);
+
+    // switches: not calibrating, back panel on FWD and SWR, hold pot mid scale
+    SetPin(avr, 'D', PD_CALIBRATE, true);
+    SetPin(avr, 'D', PD_ALO_SWITCH, true);
+    SetPin(avr, 'D', PD_FWD_SWITCH, true);
+    SetAdc(avr, ADC_HOLD_POT, 2500);
+    ApplyCoupler(h);
+    avr_cycle_timer_register_usec(avr, DOT_USEC, OnKey, &h);
+    Send(h, "P PEAK\nSUB A=1\nSUB P=1\nSUB H=1\nSUB S=1\nSUB L=1\nSUB W=1\n");
+
+    struct Phase { bool sp3t1; bool sp3t2; uint16_t forwardMv; uint16_t reverseMv; };
+    const Phase phases[] = {
+        // SP3T in the middle (both high) is PEAK HOLD. Either low is PEAK or AVERAGE
+        { true, true, 3000, 600 },
+        { false, true, 3000, 600 },
+        { true, false, 3000, 600 },
+        { true, true, 30000, 6000 }, // above the undivided inputs
+        { false, true, 30000, 6000 },
+        { true, false, 30000, 6000 },
+    };
+    uint16_t minSp = RAMEND;
+    int state = cpu_Running;
+    for (const Phase &p : phases)
+    {
+        SetPin(avr, 'D', PD_SP3T_1, p.sp3t1);
+        SetPin(avr, 'D', PD_SP3T_2, p.sp3t2);
+        h.forwardMv = p.forwardMv;
+        h.reverseMv = p.reverseMv;
+        ApplyCoupler(h);
+        avr_cycle_count_t end = avr->cycle + static_cast<avr_cycle_count_t>(seconds * CPU_HZ);
+        while (avr->cycle < end)
+        {
+            state = avr_run(avr);
+            if (state == cpu_Done || state == cpu_Crashed)
+                break;
+            uint16_t sp = StackPointer(avr);
+            if (sp < minSp)
+                minSp = sp;
+        }
+        if (state == cpu_Done || state == cpu_Crashed)
+            break;
+        // keep the subscriptions, and P PEAK, from timing out
+        Send(h, "P PEAK\n");
+    }
+    if (state == cpu_Crashed)
+    {
+        std::fprintf(stderr, "pmbudget: %s crashed at pc 0x%x\n", elf, avr->pc);
+        return 1;
+    }
+
+    std::printf("stack=%u", static_cast<unsigned>(RAMEND - minSp));
+    for (int i = 1; i < NUM_MARKERS; i++)
+        std::printf(" %s=%llu %s_count=%lu", MarkerNames[i],
+            static_cast<unsigned long long>(h.markers[i].worst), MarkerNames[i], h.markers[i].count);
+    std::printf("\n");
+    return 0;
+}
@@ -0,0 +1,354 @@
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include "Aggregator.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <system_error>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace NyeViking {
+
+    namespace {
+        std::system_error Error(const std::string &what)
+        {
+            return std::system_error(errno, std::generic_category(), what);
+        }
+
+        const int MAX_EVENTS = 64;
+        const size_t MAX_LINE = 256;
+    }
+
+    // passed to std::chrono::milliseconds by reference, so needs a definition
+    const unsigned Aggregator::ReopenMsec;
+
+    Aggregator::Aggregator(Meter::Output o)
+        : m_epoll(-1)
+        , m_listener(Source::LISTENER)
+        , m_listenFd(-1)
+        , m_output(o)
+    {
+        m_epoll = ::epoll_create1(EPOLL_CLOEXEC);
+        if (m_epoll < 0)
+            throw Error("epoll_create1");
+    }
+
+    Aggregator::~Aggregator()
+    {
+        for (auto &c : m_clients)
+            ::close(c->fd);
+        if (m_listenFd >= 0)
+        {
+            ::close(m_listenFd);
+            ::unlink(m_listenPath.c_str());
+        }
+        m_stations.clear(); // the meters send P OFF
+        ::close(m_epoll);
+    }
+
+    void Aggregator::Listen(const std::string &path)
+    {
+        struct sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+            throw std::system_error(ENAMETOOLONG, std::generic_category(), path);
+        std::strcpy(addr.sun_path, path.c_str());
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            throw Error("socket");
+        ::unlink(path.c_str());
+        if (::bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 ||
+            ::listen(fd, 16) != 0)
+        {
+            int e = errno;
+            ::close(fd);
+            throw std::system_error(e, std::generic_category(), path);
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &m_listener;
+        if (::epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+        {
+            int e = errno;
+            ::close(fd);
+            throw std::system_error(e, std::generic_category(), "epoll_ctl");
+        }
+        m_listenFd = fd;
+        m_listenPath = path;
+    }
+
+    void Aggregator::AddStation(const std::string &name, const std::string &device)
+    {
+        std::unique_ptr<Station> s(new Station);
+        s->name = name;
+        s->device = device;
+        s->reopenAt = Clock_t::now();
+        m_stations.push_back(std::move(s));
+    }
+
+    void Aggregator::Broadcast(const char *c)
+    {
+        for (auto &s : m_stations)
+            if (s->meter)
+                s->meter->Command(c);
+    }
+
+    void Aggregator::Subscribe(Stream st, unsigned decimation)
+    {
+        if (decimation == 0)
+            m_subscriptions.erase(static_cast<char>(st));
+        else
+            m_subscriptions[static_cast<char>(st)] = decimation;
+        for (auto &s : m_stations)
+            if (s->meter)
+                s->meter->Subscribe(st, decimation);
+    }
+
+    void Aggregator::Open(Station &s, Clock_t::time_point now)
+    {
+        try {
+            s.meter.reset(new Meter(s.device, m_output));
+        }
+        catch (const std::system_error &)
+        {
+            s.reopenAt = now + std::chrono::milliseconds(ReopenMsec);
+            return;
+        }
+        for (const auto &sub : m_subscriptions)
+            s.meter->Subscribe(static_cast<Stream>(sub.first), sub.second);
+        Station *sp = &s;
+        s.meter->SetRecordHandler([this, sp](const Record &r)
+        {
+            char buf[MAX_LINE];
+            std::chrono::system_clock::time_point taken;
+            size_t n = sp->meter->RecordTime(r, taken) ?
+                Stamp(buf, sizeof(buf), taken) : Stamp(buf, sizeof(buf));
+            n += std::snprintf(buf + n, sizeof(buf) - n, " %s ", sp->name.c_str());
+            n = std::min(n, sizeof(buf) - 1);
+            n += FormatRecord(r, buf + n, sizeof(buf) - n);
+            n = std::min(n, sizeof(buf) - 2);
+            buf[n++] = '\n';
+            Publish(buf, n);
+        });
+        s.meter->SetTextHandler([this, sp](const char *p, size_t n)
+        {
+            PublishStatus(*sp, p, n);
+        });
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = static_cast<Source *>(&s);
+        if (::epoll_ctl(m_epoll, EPOLL_CTL_ADD, s.meter->Fd(), &ev) != 0)
+        {
+            s.meter.reset();
+            s.reopenAt = now + std::chrono::milliseconds(ReopenMsec);
+            return;
+        }
+        static const char open[] = "open";
+        PublishStatus(s, open, sizeof(open) - 1);
+    }
+
+    void Aggregator::Close(Station &s, Clock_t::time_point now)
+    {
+        if (s.meter->Fd() >= 0)
+            ::epoll_ctl(m_epoll, EPOLL_CTL_DEL, s.meter->Fd(), nullptr);
+        s.meter.reset();
+        s.reopenAt = now + std::chrono::milliseconds(ReopenMsec);
+        static const char closed[] = "closed";
+        PublishStatus(s, closed, sizeof(closed) - 1);
+    }
+
+    void Aggregator::OnStation(Station &s, uint32_t events, Clock_t::time_point now)
+    {
+        if (!s.meter)
+            return;
+        if ((events & EPOLLERR) || (events & (EPOLLHUP | EPOLLIN)) == EPOLLHUP ||
+            !s.meter->Service(now))
+            Close(s, now);
+    }
+
+    void Aggregator::Accept()
+    {
+        for (;;)
+        {
+            int fd = ::accept4(m_listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+                return;
+            std::unique_ptr<Client> c(new Client);
+            c->fd = fd;
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.ptr = static_cast<Source *>(c.get());
+            if (::epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+            {
+                ::close(fd);
+                continue;
+            }
+            m_clients.push_back(std::move(c));
+        }
+    }
+
+    void Aggregator::OnClientReadable(Client &c)
+    {   // clients have nothing to say. Just notice when they leave
+        char buf[256];
+        for (;;)
+        {
+            ssize_t n = ::read(c.fd, buf, sizeof(buf));
+            if (n > 0)
+                continue;
+            if (n == 0 || (errno != EAGAIN && errno != EINTR))
+                c.closed = true;
+            return;
+        }
+    }
+
+    void Aggregator::OnClientWritable(Client &c)
+    {
+        ssize_t n = ::send(c.fd, c.backlog.data(), c.backlog.size(), MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EINTR)
+                c.closed = true;
+            return;
+        }
+        c.backlog.erase(0, static_cast<size_t>(n));
+        if (c.backlog.empty())
+        {
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.ptr = static_cast<Source *>(&c);
+            ::epoll_ctl(m_epoll, EPOLL_CTL_MOD, c.fd, &ev);
+        }
+    }
+
+    void Aggregator::Send(Client &c, const char *p, size_t len)
+    {
+        if (c.closed)
+            return;
+        if (c.backlog.empty())
+        {
+            ssize_t n = ::send(c.fd, p, len, MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                if (errno != EAGAIN && errno != EINTR)
+                {
+                    c.closed = true;
+                    return;
+                }
+                n = 0;
+            }
+            if (static_cast<size_t>(n) == len)
+                return;
+            p += n;
+            len -= static_cast<size_t>(n);
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLOUT;
+            ev.data.ptr = static_cast<Source *>(&c);
+            ::epoll_ctl(m_epoll, EPOLL_CTL_MOD, c.fd, &ev);
+        }
+        if (c.backlog.size() + len > MaxClientBacklog)
+        {
+            c.closed = true;
+            return;
+        }
+        c.backlog.append(p, len);
+    }
+
+    void Aggregator::Publish(const char *line, size_t len)
+    {
+        for (auto &c : m_clients)
+            Send(*c, line, len);
+    }
+
+    void Aggregator::PublishStatus(const Station &s, const char *text, size_t len)
+    {
+        char buf[MAX_LINE];
+        size_t n = Stamp(buf, sizeof(buf));
+        n += std::snprintf(buf + n, sizeof(buf) - n, " %s # %.*s\n",
+            s.name.c_str(), static_cast<int>(len), text);
+        Publish(buf, std::min(n, sizeof(buf) - 1));
+    }
+
+    size_t Aggregator::Stamp(char *buf, size_t len) const
+    {
+        return Stamp(buf, len, std::chrono::system_clock::now());
+    }
+
+    size_t Aggregator::Stamp(char *buf, size_t len, std::chrono::system_clock::time_point t) const
+    {
+        long long msec = std::chrono::duration_cast<std::chrono::milliseconds>(t.time_since_epoch()).count();
+        return std::snprintf(buf, len, "%lld.%03lld", msec / 1000, msec % 1000);
+    }
+
+    void Aggregator::RemoveClosedClients()
+    {
+        for (auto &c : m_clients)
+            if (c->closed)
+                ::close(c->fd); // which also removes it from the epoll set
+        m_clients.erase(std::remove_if(m_clients.begin(), m_clients.end(),
+            [](const std::unique_ptr<Client> &c) { return c->closed; }), m_clients.end());
+    }
+
+    void Aggregator::RunOnce(int maxWaitMsec)
+    {
+        Clock_t::time_point now = Clock_t::now();
+        int wait = maxWaitMsec;
+        for (auto &s : m_stations)
+        {
+            if (!s->meter && now >= s->reopenAt)
+                Open(*s, now);
+            int w = s->meter ?
+                s->meter->PollMsec(now) :
+                static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(s->reopenAt - now).count()) + 1;
+            if (wait < 0 || w < wait)
+                wait = w;
+        }
+
+        struct epoll_event events[MAX_EVENTS];
+        int n = ::epoll_wait(m_epoll, events, MAX_EVENTS, wait);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                return;
+            throw Error("epoll_wait");
+        }
+        now = Clock_t::now();
+        for (int i = 0; i < n; i++)
+        {
+            Source *src = static_cast<Source *>(events[i].data.ptr);
+            switch (src->kind)
+            {
+            case Source::LISTENER:
+                Accept();
+                break;
+            case Source::STATION:
+                OnStation(*static_cast<Station *>(src), events[i].events, now);
+                break;
+            case Source::CLIENT:
+                {
+                    Client &c = *static_cast<Client *>(src);
+                    if (events[i].events & (EPOLLERR | EPOLLHUP))
+                        c.closed = true;
+                    if (!c.closed && (events[i].events & EPOLLOUT))
+                        OnClientWritable(c);
+                    if (!c.closed && (events[i].events & EPOLLIN))
+                        OnClientReadable(c);
+                }
+                break;
+            }
+        }
+        // keep alives that are due, whether or not their port was readable
+        for (auto &s : m_stations)
+            if (s->meter && s->meter->PollMsec(now) == 0 && !s->meter->Service(now))
+                Close(*s, now);
+        RemoveClosedClients();
+    }
+}
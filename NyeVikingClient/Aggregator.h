@@ -0,0 +1,97 @@
+#pragma once
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "MeterClient.h"
+
+namespace NyeViking {
+
+    /* Aggregator
+    ** Any number of Meters and the clients of a unix domain stream socket, all on one
+    ** thread in one epoll set. Every record from every meter goes to every client as a
+    ** line of text:
+    **      <seconds since 1970>.<msec> <station> Vf:1234 Vr:56 Pf:12800 Pr:25 Sw:165 L
+    ** time stamped when the sketch took the record, per the Meter's ClockSync, or when the
+    ** line arrived from sketches that don't send Tm. Status lines start with '#':
+    **      <time> <station> # open|closed|<text line from the meter>
+    ** A station whose port goes away is reopened every ReopenMsec. A client that falls
+    ** more than MaxClientBacklog bytes behind is disconnected rather than buffered for.
+    ** Setup errors throw std::system_error. */
+    class Aggregator
+    {
+    public:
+        typedef Meter::Clock_t Clock_t;
+        static const unsigned ReopenMsec = 5000;
+        static const size_t MaxClientBacklog = 64 * 1024;
+
+        explicit Aggregator(Meter::Output o = Meter::Output::AVERAGE);
+        ~Aggregator();
+        Aggregator(const Aggregator &) = delete;
+        Aggregator &operator = (const Aggregator &) = delete;
+
+        // the socket is created at path. An existing socket file there is replaced
+        void Listen(const std::string &path);
+        // opens the device at the next RunOnce()
+        void AddStation(const std::string &name, const std::string &device);
+        // sends a command line to every open meter
+        void Broadcast(const char *);
+        // every meter, now and as they are opened. See Meter::Subscribe
+        void Subscribe(Stream s, unsigned decimation);
+
+        // wait at most maxWaitMsec for something to do, and do it
+        void RunOnce(int maxWaitMsec);
+        size_t StationCount() const { return m_stations.size(); }
+        size_t ClientCount() const { return m_clients.size(); }
+
+    protected:
+        struct Source
+        {
+            enum Kind { LISTENER, STATION, CLIENT } kind;
+            explicit Source(Kind k) : kind(k) {}
+        };
+        struct Station : Source
+        {
+            Station() : Source(STATION) {}
+            std::string name;
+            std::string device;
+            std::unique_ptr<Meter> meter;
+            Clock_t::time_point reopenAt;
+        };
+        struct Client : Source
+        {
+            Client() : Source(CLIENT), fd(-1), closed(false) {}
+            int fd;
+            bool closed;
+            std::string backlog; // what the socket would not take yet
+        };
+
+        void Open(Station &, Clock_t::time_point now);
+        void Close(Station &, Clock_t::time_point now);
+        void OnStation(Station &, uint32_t events, Clock_t::time_point now);
+        void Accept();
+        void OnClientWritable(Client &);
+        void OnClientReadable(Client &);
+        void Publish(const char *line, size_t len);
+        void PublishStatus(const Station &, const char *text, size_t len);
+        void Send(Client &, const char *p, size_t len);
+        void RemoveClosedClients();
+        size_t Stamp(char *buf, size_t len) const;
+        size_t Stamp(char *buf, size_t len, std::chrono::system_clock::time_point) const;
+
+        int m_epoll;
+        Source m_listener;
+        int m_listenFd;
+        std::string m_listenPath;
+        Meter::Output m_output;
+        std::map<char, unsigned> m_subscriptions;
+        std::vector<std::unique_ptr<Station>> m_stations;
+        std::vector<std::unique_ptr<Client>> m_clients;
+    };
+}
@@ -0,0 +1,212 @@
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include "Calibration.h"
+#include "MeterProtocol.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <utility>
+
+namespace NyeViking {
+
+    namespace {
+        const double GainOne = 32768; // 1.0 in the sketch's fixed point gain
+        const double CurveOne = 1073741824; // 2**30
+
+        std::string Line(const char *line, size_t len)
+        {
+            return std::string(line, len);
+        }
+
+        // the sketch's rootOf()
+        uint32_t RootOf(uint32_t s)
+        {
+            uint32_t root = 0;
+            for (uint32_t bit = 1ul << 30; bit != 0; bit >>= 2)
+            {
+                if (s >= root + bit)
+                {
+                    s -= root + bit;
+                    root = (root >> 1) + bit;
+                }
+                else
+                    root >>= 1;
+            }
+            return root;
+        }
+
+        // the sketch's calibrateCurve()
+        uint32_t CalibrateCurve(uint32_t v, const CalibrationFit &f)
+        {
+            if (v == 0)
+                return 0;
+            int32_t t = static_cast<int32_t>((v * static_cast<uint32_t>(f.gain) + 0x4000) >> 15);
+            t += static_cast<int32_t>(f.offset);
+            int32_t sq = static_cast<int32_t>((v * v) >> 15);
+            t += (sq * static_cast<int32_t>(f.curve)) / 0x8000;
+            if (t < 1)
+                return 1;
+            if (t > 0xFFFF)
+                return 0xFFFF;
+            return static_cast<uint32_t>(t);
+        }
+
+        // a x = b by Gaussian elimination with partial pivoting. false if singular
+        template <size_t N>
+        bool Solve(double (&a)[N][N], double (&b)[N], size_t n)
+        {
+            for (size_t c = 0; c < n; c++)
+            {
+                size_t pivot = c;
+                for (size_t r = c + 1; r < n; r++)
+                    if (std::fabs(a[r][c]) > std::fabs(a[pivot][c]))
+                        pivot = r;
+                if (std::fabs(a[pivot][c]) < 1e-12)
+                    return false;
+                for (size_t k = 0; k < n; k++)
+                    std::swap(a[c][k], a[pivot][k]);
+                std::swap(b[c], b[pivot]);
+                for (size_t r = c + 1; r < n; r++)
+                {
+                    double m = a[r][c] / a[c][c];
+                    for (size_t k = c; k < n; k++)
+                        a[r][k] -= m * a[c][k];
+                    b[r] -= m * b[c];
+                }
+            }
+            for (size_t c = n; c-- > 0;)
+            {
+                for (size_t k = c + 1; k < n; k++)
+                    b[c] -= a[c][k] * b[k];
+                b[c] /= a[c][c];
+            }
+            return true;
+        }
+    }
+
+    double CalibrationPoint::Volts() const
+    {
+        return std::sqrt(static_cast<double>(square));
+    }
+
+    double CalibrationPoint::TrueVolts() const
+    {
+        // the sketch's power is linear in the mean square, so volts go as the root of the power ratio
+        return Volts() * std::sqrt(static_cast<double>(watts) / nominal);
+    }
+
+    bool ParseCalibrationPoint(const char *line, size_t len, CalibrationPoint &p)
+    {
+        std::string s = Line(line, len);
+        unsigned n;
+        unsigned long w, sq, nom;
+        char dir;
+        if (std::sscanf(s.c_str(), "CAL %u W:%lu %c:%lu N:%lu", &n, &w, &dir, &sq, &nom) != 5)
+            return false;
+        if (dir != 'F' && dir != 'R')
+            return false;
+        p.n = n;
+        p.reflected = dir == 'R';
+        p.watts = static_cast<uint32_t>(w);
+        p.square = static_cast<uint32_t>(sq);
+        p.nominal = static_cast<uint32_t>(nom);
+        return true;
+    }
+
+    bool ParseCalibrationFit(const char *line, size_t len, CalibrationFit &f)
+    {
+        std::string s = Line(line, len);
+        char dir;
+        long g, o, c;
+        if (std::sscanf(s.c_str(), "CAL%c G:%ld O:%ld C:%ld", &dir, &g, &o, &c) != 4)
+            return false;
+        if (dir != 'F' && dir != 'R')
+            return false;
+        f.reflected = dir == 'R';
+        f.gain = g;
+        f.offset = o;
+        f.curve = c;
+        f.terms = c != 0 ? 3 : o != 0 ? 2 : 1;
+        return true;
+    }
+
+    bool FitCalibration(const std::vector<CalibrationPoint> &points, bool reflected, CalibrationFit &fit)
+    {
+        std::vector<std::pair<double, double>> xy; // measured volts, true volts
+        double scale = 0;
+        for (const auto &p : points)
+        {
+            if (p.reflected != reflected || p.watts == 0 || p.square == 0 || p.nominal == 0)
+                continue;
+            xy.emplace_back(p.Volts(), p.TrueVolts());
+            scale = std::max(scale, p.Volts());
+        }
+        if (xy.empty())
+            return false;
+        // true = a0 + a1 x + a2 x * x, x in units of the largest measured volts, for conditioning
+        size_t terms = xy.size() < 3 ? xy.size() : 3;
+        double a[3][3] = {};
+        double b[3] = {};
+        double coef[3] = {};
+        if (terms == 1)
+        {
+            double x = xy[0].first / scale;
+            coef[1] = xy[0].second / x;
+        }
+        else
+        {   // normal equations in powers 0 through terms-1
+            for (const auto &pt : xy)
+            {
+                double x = pt.first / scale;
+                double pw[3] = { 1, x, x * x };
+                for (size_t r = 0; r < terms; r++)
+                {
+                    for (size_t c = 0; c < terms; c++)
+                        a[r][c] += pw[r] * pw[c];
+                    b[r] += pw[r] * pt.second;
+                }
+            }
+            if (!Solve(a, b, terms))
+                return false;
+            for (size_t i = 0; i < terms; i++)
+                coef[i] = b[i];
+        }
+        fit.reflected = reflected;
+        fit.terms = static_cast<unsigned>(terms);
+        fit.gain = std::lround(coef[1] / scale * GainOne);
+        fit.offset = std::lround(coef[0]);
+        fit.curve = std::lround(coef[2] / (scale * scale) * CurveOne);
+        return fit.gain > 0 && fit.gain <= 0xFFFF &&
+            fit.offset >= -0x8000 && fit.offset <= 0x7FFF &&
+            fit.curve >= -0x8000 && fit.curve <= 0x7FFF;
+    }
+
+    double CalibratedWatts(const CalibrationFit &f, const CalibrationPoint &p)
+    {
+        if (p.square == 0)
+            return 0;
+        double calibratedSquare;
+        if (f.offset == 0 && f.curve == 0)
+            calibratedSquare = static_cast<double>(p.square) * f.gain * f.gain / (GainOne * GainOne);
+        else
+        {
+            double v = CalibrateCurve(RootOf(p.square), f);
+            calibratedSquare = v * v;
+        }
+        return static_cast<double>(p.nominal) / WattsToDisplay * calibratedSquare / p.square;
+    }
+
+    std::vector<std::string> FitCommands(const CalibrationFit &f)
+    {
+        char d = f.reflected ? 'R' : 'F';
+        char buf[3][24];
+        std::snprintf(buf[0], sizeof(buf[0]), "CALG %c=%ld", d, f.gain);
+        std::snprintf(buf[1], sizeof(buf[1]), "CALO %c=%ld", d, f.offset);
+        std::snprintf(buf[2], sizeof(buf[2]), "CALC %c=%ld", d, f.curve);
+        return std::vector<std::string>(buf, buf + 3);
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Multipoint power calibration. See namespace calibrate in the sketch.
+** "CAL n=watts" captures a point, and the sketch answers with it. "CAL" lists every point, then the fit in use:
+**      CAL 2 W:1600 F:41830912 N:1491
+**      CALF G:32768 O:0 C:0
+**      CALR G:32768 O:0 C:0
+**      W   the reference power, in 1/128 watt
+**      F   forward, or R reflected: mean square volts, uncalibrated, in the sketch's AcquiredVolts_t
+**      N   the power that mean square shows uncalibrated, in 1/128 watt
+**      G   gain in 1/32768ths, O offset in AcquiredVolts_t, C curve in 1/2**30 per AcquiredVolts_t
+** The sketch's calibrated volts are G * v + O + C * v * v, and its power goes as their square. */
+
+namespace NyeViking {
+
+    struct CalibrationPoint
+    {
+        unsigned n = 0;
+        bool reflected = false;
+        uint32_t watts = 0;
+        uint32_t square = 0;
+        uint32_t nominal = 0;
+
+        double Volts() const; // root mean square, as the sketch has it
+        double TrueVolts() const; // the volts that show the reference power
+    };
+
+    struct CalibrationFit
+    {
+        bool reflected = false;
+        long gain = 32768;
+        long offset = 0;
+        long curve = 0;
+        unsigned terms = 0; // 1 gain only, 2 plus offset, 3 plus curve
+    };
+
+    // one of the CAL lines above. false if it isn't one
+    bool ParseCalibrationPoint(const char *line, size_t len, CalibrationPoint &);
+    bool ParseCalibrationFit(const char *line, size_t len, CalibrationFit &);
+
+    /* Least squares through the points in one direction: gain with one point, offset too
+    ** with two, curve too with three or more. false if there are no usable points or the
+    ** terms don't fit the sketch's 16 bits. */
+    bool FitCalibration(const std::vector<CalibrationPoint> &, bool reflected, CalibrationFit &);
+
+    // watts the sketch will show for p's mean square with this fit, in its fixed point arithmetic
+    double CalibratedWatts(const CalibrationFit &, const CalibrationPoint &p);
+
+    // the CALG, CALO and CALC commands that store the fit
+    std::vector<std::string> FitCommands(const CalibrationFit &);
+}
@@ -0,0 +1,135 @@
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include "ClockSync.h"
+#include <cmath>
+#include <cstdlib>
+
+namespace NyeViking {
+
+    ClockSync::ClockSync(unsigned long baud)
+        : m_byteNsec(static_cast<int64_t>(10 * 1000000000.0 / baud)) // start, 8 data, stop
+    {
+        Reset();
+    }
+
+    void ClockSync::Reset()
+    {
+        m_next = 0;
+        m_count = 0;
+        m_lastDevice = 0;
+        m_haveDevice = false;
+        m_fitted = false;
+        m_x0 = 0;
+        m_offset = 0;
+        m_slope = 0;
+        m_bestHalfRtt = 0;
+    }
+
+    int64_t ClockSync::Unwrap(uint32_t deviceMicros) const
+    {
+        if (!m_haveDevice)
+            return deviceMicros;
+        // signed distance from the latest, modulo 2**32
+        int32_t d = static_cast<int32_t>(deviceMicros - static_cast<uint32_t>(m_lastDevice));
+        return m_lastDevice + d;
+    }
+
+    void ClockSync::AddExchange(int64_t hostSentNsec, int64_t hostReceivedNsec, uint32_t deviceMicros,
+        size_t sentBytes, size_t receivedBytes)
+    {
+        // the sketch stamps the PONG when it has the whole PING, and before it sends the PONG
+        int64_t arrived = hostSentNsec + static_cast<int64_t>(sentBytes) * m_byteNsec;
+        int64_t replied = hostReceivedNsec - static_cast<int64_t>(receivedBytes) * m_byteNsec;
+        if (replied < arrived)
+            replied = arrived; // the line was faster than its baud rate says. Don't go negative
+        int64_t halfRtt = (replied - arrived) / 2;
+        int64_t host = arrived + halfRtt;
+        int64_t device = Unwrap(deviceMicros);
+        if (m_haveDevice)
+        {
+            bool jumped = device < m_lastDevice;
+            if (m_fitted)
+                jumped = jumped || std::llabs(host - FitHostNsec(device * 1000)) > JumpNsec + 4 * halfRtt;
+            if (jumped)
+            {
+                Reset();
+                device = Unwrap(deviceMicros);
+            }
+        }
+        Sample &s = m_samples[m_next];
+        s.deviceNsec = device * 1000;
+        s.hostNsec = host;
+        s.halfRtt = halfRtt;
+        m_next = (m_next + 1) % Window;
+        if (m_count < Window)
+            m_count += 1;
+        m_lastDevice = device;
+        m_haveDevice = true;
+        Fit();
+    }
+
+    void ClockSync::Fit()
+    {
+        if (m_count < MinToFit)
+            return;
+        // the quickest exchange of each run, oldest first
+        const size_t run = (m_count + Segments - 1) / Segments;
+        const Sample *kept[Segments];
+        size_t numKept = 0;
+        size_t oldest = (m_next + Window - m_count) % Window;
+        for (size_t i = 0; i < m_count; i++)
+        {
+            const Sample &s = m_samples[(oldest + i) % Window];
+            if (i % run == 0)
+                kept[numKept++] = &s;
+            else if (s.halfRtt < kept[numKept - 1]->halfRtt)
+                kept[numKept - 1] = &s;
+        }
+        int64_t best = kept[0]->halfRtt;
+        for (size_t i = 1; i < numKept; i++)
+            if (kept[i]->halfRtt < best)
+                best = kept[i]->halfRtt;
+        m_bestHalfRtt = best;
+
+        // least squares of host minus device against device, relative to the first kept
+        const Sample &first = *kept[0];
+        double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+        for (size_t i = 0; i < numKept; i++)
+        {
+            const Sample &s = *kept[i];
+            double x = static_cast<double>(s.deviceNsec - first.deviceNsec);
+            double y = static_cast<double>((s.hostNsec - s.deviceNsec) - (first.hostNsec - first.deviceNsec));
+            n += 1;
+            sx += x;
+            sy += y;
+            sxx += x * x;
+            sxy += x * y;
+        }
+        double det = n * sxx - sx * sx;
+        // points close together in time can't tell drift from latency. Keep the drift we had
+        const double MinSpanNsec = 4e9;
+        double slope = -m_slope; // y is host minus device, so device fast is a negative slope
+        if (n >= 2 && det > 0 && std::sqrt(det) / n > MinSpanNsec / 4)
+            slope = (n * sxy - sx * sy) / det;
+        double intercept = (sy - slope * sx) / n;
+        m_x0 = first.deviceNsec;
+        m_offset = static_cast<double>(first.hostNsec - first.deviceNsec) + intercept;
+        m_slope = -slope;
+        m_fitted = true;
+    }
+
+    int64_t ClockSync::FitHostNsec(int64_t deviceNsec) const
+    {
+        double dx = static_cast<double>(deviceNsec - m_x0);
+        return deviceNsec + static_cast<int64_t>(std::llround(m_offset - m_slope * dx));
+    }
+
+    int64_t ClockSync::DeviceToHostNsec(uint32_t deviceMicros) const
+    {
+        return FitHostNsec(Unwrap(deviceMicros) * 1000);
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <cstddef>
+#include <cstdint>
+
+namespace NyeViking {
+
+    /* ClockSync
+    ** Maps the sketch's micros() to a host clock, from PING/PONG exchanges.
+    ** The host notes when it wrote "PING=n", and when "PONG=n Tm:<micros>" arrived. Time on
+    ** the wire is known from the line lengths and the baud rate, and is taken out. What is
+    ** left is USB and FTDI latency, which only ever delays, and differs from one exchange
+    ** to the next by up to the FTDI latency timer. So the window is cut into Segments runs
+    ** of consecutive exchanges, only the quickest of each run is kept, and a straight line
+    ** (offset plus drift, because the Pro Mini's resonator is only good to a fraction of a
+    ** percent) is fit through those by least squares. Taking one from each run, rather
+    ** than every exchange near the quickest, keeps the points spread across the window
+    ** so the drift stays well conditioned.
+    ** micros() stops while the sketch sleeps, and starts over from zero when it resets. An
+    ** exchange that goes backwards, or that is further from the fit than JumpNsec plus a few
+    ** of its own round trips, means that happened, and the fit starts over from it.
+    ** Host times are nanoseconds on any monotonic clock the caller chooses. */
+    class ClockSync
+    {
+    public:
+        static const size_t Window = 128; // exchanges
+        static const size_t Segments = 8; // runs of Window / Segments, once the window fills
+        static const size_t MinToFit = 4;
+        static const int64_t JumpNsec = 100000000; // a record interval
+
+        explicit ClockSync(unsigned long baud);
+
+        // one exchange. sentBytes and receivedBytes include line terminators
+        void AddExchange(int64_t hostSentNsec, int64_t hostReceivedNsec, uint32_t deviceMicros,
+            size_t sentBytes, size_t receivedBytes);
+        void Reset();
+
+        bool Valid() const { return m_fitted; }
+        // host time at which micros() read deviceMicros. Valid() must be true.
+        // deviceMicros must be within about half an hour of the latest exchange
+        int64_t DeviceToHostNsec(uint32_t deviceMicros) const;
+        // how much faster the sketch's micros() runs than the host clock
+        double DriftPpm() const { return m_slope * 1e6; }
+        // half the quickest round trip in the window: the worst case error of the best exchange
+        int64_t UncertaintyNsec() const { return m_bestHalfRtt; }
+        size_t Count() const { return m_count; }
+
+    protected:
+        struct Sample
+        {
+            int64_t deviceNsec; // unwrapped
+            int64_t hostNsec; // estimated host time of the device's stamp
+            int64_t halfRtt;
+        };
+        int64_t Unwrap(uint32_t deviceMicros) const;
+        int64_t FitHostNsec(int64_t deviceNsec) const;
+        void Fit();
+
+        int64_t m_byteNsec;
+        Sample m_samples[Window];
+        size_t m_next;
+        size_t m_count;
+        int64_t m_lastDevice; // unwrapped micros of the latest exchange
+        bool m_haveDevice;
+        bool m_fitted;
+        int64_t m_x0; // fit is host = device + m_offset - m_slope * (device - m_x0)
+        double m_offset;
+        double m_slope;
+        int64_t m_bestHalfRtt;
+    };
+}
@@ -0,0 +1,242 @@
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include "MeterClient.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+
+namespace NyeViking {
+
+    // these go to std::chrono::milliseconds by reference, so need a definition
+    const unsigned Meter::InitialRequestMsec;
+    const unsigned Meter::PingMsec;
+
+    Meter::Meter(const std::string &device, Output o)
+        : m_port(device)
+        , m_output(o)
+        , m_haveReceived(false)
+        , m_nextPing(Clock_t::time_point::max()) // until a record with Tm arrives
+        , m_lastTm(0)
+        , m_haveTm(false)
+        , m_pingNumber(0)
+        , m_pingLength(0)
+        , m_pingOutstanding(false)
+        , m_sync(SerialPort::DefaultBaud)
+    {
+        m_parser.SetRecordHandler([this](const Record &r) { OnRecord(r); });
+        m_parser.SetTextHandler([this](const char *p, size_t n) { OnText(p, n); });
+        SendRequest(Clock_t::now());
+    }
+
+    Meter::~Meter()
+    {
+        if (m_port.IsOpen())
+            m_port.WriteLine("P OFF");
+    }
+
+    void Meter::SetOutput(Output o)
+    {
+        m_output = o;
+        SendRequest(Clock_t::now());
+    }
+
+    bool Meter::Command(const char *c)
+    {
+        return m_port.WriteLine(c);
+    }
+
+    bool Meter::Subscribe(Stream s, unsigned decimation)
+    {
+        if (decimation > 255)
+            decimation = 255; // the sketch keeps a byte
+        char buf[16];
+        std::snprintf(buf, sizeof(buf), "SUB %c=%u", static_cast<char>(s), decimation);
+        if (decimation == 0)
+            m_subscriptions.erase(static_cast<char>(s));
+        else
+            m_subscriptions[static_cast<char>(s)] = decimation;
+        return m_port.WriteLine(buf);
+    }
+
+    bool Meter::SendRequest(Clock_t::time_point now)
+    {
+        m_nextRequest = now + std::chrono::milliseconds(m_haveReceived ? KeepAliveMsec : InitialRequestMsec);
+        bool ok = true;
+        if (m_output != Output::NONE)
+            ok = m_port.WriteLine(m_output == Output::AVERAGE ? "P ON" : "P PEAK");
+        for (const auto &sub : m_subscriptions)
+        {
+            char buf[16];
+            std::snprintf(buf, sizeof(buf), "SUB %c=%u", sub.first, sub.second);
+            ok = ok && m_port.WriteLine(buf);
+        }
+        return ok;
+    }
+
+    bool Meter::SendPing(Clock_t::time_point now)
+    {   // an unanswered PING is abandoned. The sketch may be one that doesn't know it
+        char buf[16];
+        m_pingNumber = (m_pingNumber + 1) % 10000;
+        int n = std::snprintf(buf, sizeof(buf), "PING=%u", m_pingNumber);
+        m_pingLength = static_cast<size_t>(n) + 1; // and the newline
+        m_nextPing = now + std::chrono::milliseconds(PingMsec);
+        m_pingSent = Clock_t::now();
+        m_pingOutstanding = true;
+        return m_port.WriteLine(buf);
+    }
+
+    void Meter::OnText(const char *p, size_t n)
+    {
+        static const char PONG[] = "PONG=";
+        const size_t PONG_LEN = sizeof(PONG) - 1;
+        if (n > PONG_LEN && std::strncmp(p, PONG, PONG_LEN) == 0)
+        {   // PONG=n Tm:t
+            char buf[32];
+            size_t len = std::min(n, sizeof(buf) - 1);
+            std::memcpy(buf, p, len);
+            buf[len] = 0;
+            char *end;
+            unsigned long number = std::strtoul(buf + PONG_LEN, &end, 10);
+            if (std::strncmp(end, " Tm:", 4) == 0 && m_pingOutstanding && number == m_pingNumber)
+            {
+                uint32_t t = static_cast<uint32_t>(std::strtoul(end + 4, nullptr, 10));
+                m_pingOutstanding = false;
+                m_sync.AddExchange(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(m_pingSent.time_since_epoch()).count(),
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(m_lastRead.time_since_epoch()).count(),
+                    t, m_pingLength, n + 2); // println sends CR LF
+            }
+            return;
+        }
+        if (m_onText)
+            m_onText(p, n);
+    }
+
+    bool Meter::RecordTime(const Record &r, Clock_t::time_point &t) const
+    {
+        if (!r.Has(Record::TM) || !m_sync.Valid())
+            return false;
+        t = Clock_t::time_point(std::chrono::duration_cast<Clock_t::duration>(
+            std::chrono::nanoseconds(m_sync.DeviceToHostNsec(r.Tm))));
+        return true;
+    }
+
+    bool Meter::RecordTime(const Record &r, std::chrono::system_clock::time_point &t) const
+    {
+        Clock_t::time_point steady;
+        if (!RecordTime(r, steady))
+            return false;
+        // the wall clock may be stepped. Take the record's age on the steady clock instead
+        t = std::chrono::system_clock::now() -
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(Clock_t::now() - steady);
+        return true;
+    }
+
+    void Meter::OnRecord(const Record &r)
+    {
+        if (!m_haveReceived)
+        {
+            m_haveReceived = true;
+            m_nextRequest = Clock_t::now() + std::chrono::milliseconds(KeepAliveMsec);
+            if (r.Has(Record::TM))
+                m_nextPing = Clock_t::now();
+        }
+        if (r.Has(Record::TM))
+        {   // micros() started over. The sketch rebooted
+            if (m_haveTm && static_cast<int32_t>(r.Tm - m_lastTm) < 0)
+            {
+                m_sync.Reset();
+                m_pingOutstanding = false;
+                m_nextPing = Clock_t::now();
+            }
+            m_lastTm = r.Tm;
+            m_haveTm = true;
+        }
+        if (m_onRecord)
+            m_onRecord(r);
+        if (!r.Has(Record::LEGACY))
+            return; // a subscription line
+        if (m_onPower)
+            m_onPower(r.ForwardWatts(), r.ReflectedWatts());
+        if (m_onSwr)
+        {
+            double swr = r.Swr();
+            if (!std::isnan(swr))
+                m_onSwr(swr);
+        }
+    }
+
+    bool Meter::Service(Clock_t::time_point now)
+    {
+        char buf[256];
+        for (;;)
+        {
+            long n = m_port.Read(buf, sizeof(buf));
+            if (n < 0)
+            {
+                m_port.Close();
+                return false;
+            }
+            if (n == 0)
+                break;
+            m_lastRead = Clock_t::now();
+            m_parser.Feed(buf, static_cast<size_t>(n));
+        }
+        if (now >= m_nextRequest)
+        {
+            if (!SendRequest(now))
+            {
+                m_port.Close();
+                return false;
+            }
+        }
+        if (now >= m_nextPing)
+        {
+            if (!SendPing(now))
+            {
+                m_port.Close();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int Meter::PollMsec(Clock_t::time_point now) const
+    {
+        Clock_t::time_point next = std::min(m_nextRequest, m_nextPing);
+        if (now >= next)
+            return 0;
+        return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count()) + 1;
+    }
+
+    void Meter::Run(std::function<bool()> stop)
+    {
+        while (m_port.IsOpen() && !(stop && stop()))
+        {
+            struct pollfd pfd;
+            pfd.fd = m_port.Fd();
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            int wait = PollMsec();
+            if (stop && wait > 100)
+                wait = 100; // check stop() at least this often
+            if (::poll(&pfd, 1, wait) < 0 && errno != EINTR)
+                break;
+            if ((pfd.revents & (POLLERR | POLLNVAL)) || (pfd.revents & (POLLHUP | POLLIN)) == POLLHUP)
+            {   // unplugged, or hung up with nothing left to read
+                m_port.Close();
+                break;
+            }
+            if (!Service())
+                break;
+        }
+    }
+}
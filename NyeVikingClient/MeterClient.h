@@ -0,0 +1,107 @@
+#pragma once
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include "ClockSync.h"
+#include "MeterProtocol.h"
+#include "SerialPort.h"
+
+namespace NyeViking {
+
+    /* Meter
+    ** One PowerMeter console on a serial port. It requests output with "P ON" or "P PEAK",
+    ** and with "SUB x=n" for each Subscribe(), and repeats those requests before the
+    ** sketch's OUTPUT_TIMEOUT_MSEC expires, so output
+    ** keeps coming for as long as the Meter is open. Until the first record arrives,
+    ** the request is repeated every InitialRequestMsec, because opening the port can
+    ** reset the Arduino and the first request is lost in its boot loader.
+    **
+    ** Once records arrive, it sends "PING=n" every PingMsec and feeds the answers to a
+    ** ClockSync, so RecordTime() can say when a record was taken on the host's clock, to
+    ** well under the 100 msec between records. Sketches that don't answer PING are
+    ** timed by arrival, as before. A record whose Tm goes backwards means the sketch
+    ** reset, and the ClockSync starts over.
+    **
+    ** Either call Run(), or put Fd() in your own poll/select/epoll set and call
+    ** Service() when it is readable, and at least every PollMsec(). */
+    class Meter
+    {
+    public:
+        enum class Output { AVERAGE, PEAK, NONE }; // NONE for only subscriptions
+        typedef std::chrono::steady_clock Clock_t;
+        typedef std::function<void(double)> SwrHandler_t;
+        typedef std::function<void(double fwd, double refl)> PowerHandler_t;
+
+        static const unsigned InitialRequestMsec = 500;
+        static const unsigned PingMsec = 1000;
+
+        explicit Meter(const std::string &device, Output o = Output::AVERAGE);
+        ~Meter();
+
+        void SetOutput(Output o);
+        Output GetOutput() const { return m_output; }
+        // stream s every decimation'th update of the sketch's 100 msec. 0 unsubscribes
+        bool Subscribe(Stream s, unsigned decimation);
+
+        void SetRecordHandler(RecordParser::RecordHandler_t h) { m_onRecord = h; }
+        void SetTextHandler(RecordParser::TextHandler_t h) { m_onText = h; } // PONGs are not passed on
+        void SetBinaryHandler(RecordParser::BinaryHandler_t h) { m_parser.SetBinaryHandler(h); } // BIN frames
+        // these two are from the P ON or P PEAK records, not subscriptions
+        void SetSwrHandler(SwrHandler_t h) { m_onSwr = h; } // only while there is forward power
+        void SetPowerHandler(PowerHandler_t h) { m_onPower = h; } // watts
+
+        int Fd() const { return m_port.Fd(); }
+        const std::string &Device() const { return m_port.Device(); }
+        bool IsOpen() const { return m_port.IsOpen(); }
+        // sends a command line. The sketch upper-cases it
+        bool Command(const char *);
+
+        // read what is available, dispatch callbacks, send keep alive if due.
+        // false once the port is gone
+        bool Service(Clock_t::time_point now = Clock_t::now());
+        // msec until the next keep alive or PING is due
+        int PollMsec(Clock_t::time_point now = Clock_t::now()) const;
+        // Service() until the port goes away or stop() returns true
+        void Run(std::function<bool()> stop = std::function<bool()>());
+
+        unsigned long RecordCount() const { return m_parser.RecordCount(); }
+
+        // when the sketch took the record, if it sent Tm and the clocks are synchronized
+        bool RecordTime(const Record &, Clock_t::time_point &) const;
+        bool RecordTime(const Record &, std::chrono::system_clock::time_point &) const;
+        const ClockSync &Sync() const { return m_sync; }
+
+    protected:
+        void OnRecord(const Record &);
+        bool SendRequest(Clock_t::time_point now);
+        bool SendPing(Clock_t::time_point now);
+        void OnText(const char *, size_t);
+
+        SerialPort m_port;
+        RecordParser m_parser;
+        Output m_output;
+        std::map<char, unsigned> m_subscriptions;
+        bool m_haveReceived;
+        Clock_t::time_point m_nextRequest;
+        Clock_t::time_point m_nextPing;
+        Clock_t::time_point m_pingSent;
+        Clock_t::time_point m_lastRead; // when the bytes being parsed arrived
+        uint32_t m_lastTm; // of the latest record that had one
+        bool m_haveTm;
+        unsigned m_pingNumber;
+        size_t m_pingLength;
+        bool m_pingOutstanding;
+        ClockSync m_sync;
+        RecordParser::RecordHandler_t m_onRecord;
+        RecordParser::TextHandler_t m_onText;
+        SwrHandler_t m_onSwr;
+        PowerHandler_t m_onPower;
+    };
+}
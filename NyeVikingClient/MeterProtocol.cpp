@@ -0,0 +1,200 @@
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include "MeterProtocol.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+namespace NyeViking {
+
+    double Record::Swr() const
+    {
+        if (Vf == 0)
+            return std::numeric_limits<double>::quiet_NaN();
+        if (Vr >= Vf)
+            return std::numeric_limits<double>::infinity();
+        return static_cast<double>(Vf + Vr) / static_cast<double>(Vf - Vr);
+    }
+
+    double Record::MeterSwr() const
+    {
+        if (Sw < SwrScale)
+            return std::numeric_limits<double>::quiet_NaN();
+        if (Sw >= InfiniteSwr * SwrScale)
+            return std::numeric_limits<double>::infinity();
+        return static_cast<double>(Sw) / SwrScale;
+    }
+
+    bool ParseSubscription(const char *s, Stream &stream, unsigned &decimation)
+    {
+        static const char LETTERS[] = "APHSLW";
+        char x = static_cast<char>(std::toupper(static_cast<unsigned char>(s[0])));
+        if (x == 0 || std::strchr(LETTERS, x) == nullptr || s[1] != '=')
+            return false;
+        char *end;
+        unsigned long n = std::strtoul(s + 2, &end, 10);
+        if (end == s + 2 || *end != 0 || n > 255)
+            return false;
+        stream = static_cast<Stream>(x);
+        decimation = static_cast<unsigned>(n);
+        return true;
+    }
+
+    RecordParser::RecordParser() : m_len(0), m_overflow(false), m_records(0), m_errors(0), m_binaryLeft(0)
+    {}
+
+    void RecordParser::Feed(const char *p, size_t n)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            if (m_binaryLeft != 0)
+            {   // inside a BIN frame
+                size_t take = std::min(n - i, m_binaryLeft);
+                m_binary.insert(m_binary.end(), p + i, p + i + take);
+                m_binaryLeft -= take;
+                i += take - 1;
+                if (m_binaryLeft == 0 && m_onBinary)
+                    m_onBinary(m_binary.data(), m_binary.size());
+                continue;
+            }
+            char c = p[i];
+            if (c == '\r' || c == '\n')
+            {
+                EndOfLine(c);
+                continue;
+            }
+            if (m_len < MAX_LINE)
+                m_line[m_len++] = c;
+            else
+                m_overflow = true;
+        }
+    }
+
+    void RecordParser::EndOfLine(char terminator)
+    {
+        static const char BIN[] = "BIN ";
+        const size_t BIN_LEN = sizeof(BIN) - 1;
+        if (!m_overflow && terminator == '\n' && m_len > BIN_LEN && std::strncmp(m_line, BIN, BIN_LEN) == 0)
+        {
+            size_t n = 0;
+            size_t i = BIN_LEN;
+            for (; i < m_len && std::isdigit(static_cast<unsigned char>(m_line[i])); i++)
+                n = n * 10 + (m_line[i] - '0');
+            if (i == m_len && n > 0 && n <= MAX_BINARY)
+            {   // the frame starts with the next byte
+                m_binary.clear();
+                m_binaryLeft = n;
+                Reset();
+                return;
+            }
+        }
+        if (m_overflow)
+            m_errors += 1; // nothing the sketch sends is this long. Drop it
+        else if (m_len > 0)
+        {
+            Record r;
+            if (ParseLine(m_line, m_len, r))
+            {
+                m_records += 1;
+                if (m_onRecord)
+                    m_onRecord(r);
+            }
+            else if (m_onText)
+                m_onText(m_line, m_len);
+        }
+        Reset();
+    }
+
+    namespace {
+        struct FieldName
+        {
+            char name[3];
+            Record::Field bit;
+            uint32_t Record::*member;
+        };
+        const FieldName FIELDS[] = {
+            { "Vf", Record::VF, &Record::Vf }, { "Vr", Record::VR, &Record::Vr },
+            { "Pf", Record::PF, &Record::Pf }, { "Pr", Record::PR, &Record::Pr },
+            { "Fa", Record::FA, &Record::Fa }, { "Ra", Record::RA, &Record::Ra },
+            { "Fp", Record::FP, &Record::Fp }, { "Rp", Record::RP, &Record::Rp },
+            { "Fh", Record::FH, &Record::Fh }, { "Rh", Record::RH, &Record::Rh },
+            { "Sw", Record::SW, &Record::Sw }, { "Ls", Record::LS, &Record::Ls },
+            { "Ws", Record::WS, &Record::Ws }, { "Tm", Record::TM, &Record::Tm },
+        };
+
+        // digits from p up to end. false if none, or anything else
+        bool ParseUnsigned(const char *p, const char *end, uint32_t &v)
+        {
+            if (p == end)
+                return false;
+            uint32_t r = 0;
+            for (; p < end; p++)
+            {
+                if (*p < '0' || *p > '9')
+                    return false;
+                r = r * 10 + (*p - '0');
+            }
+            v = r;
+            return true;
+        }
+    }
+
+    bool RecordParser::ParseLine(const char *line, size_t len, Record &r)
+    {
+        r = Record();
+        const char *end = line + len;
+        const char *p = line;
+        while (p < end)
+        {
+            while (p < end && *p == ' ')
+                p += 1;
+            const char *tok = p;
+            while (p < end && *p != ' ')
+                p += 1;
+            size_t tlen = p - tok;
+            if (tlen == 0)
+                break;
+            if (tlen == 1 && *tok == 'L')
+            {
+                r.locked = true;
+                continue;
+            }
+            if (tlen < 4 || tok[2] != ':')
+                return false;
+            uint32_t v;
+            if (!ParseUnsigned(tok + 3, p, v))
+                return false;
+            for (const FieldName &f : FIELDS)
+                if (tok[0] == f.name[0] && tok[1] == f.name[1])
+                {
+                    r.*f.member = v;
+                    r.fields |= f.bit;
+                    break;
+                }
+            // other two letter fields are skipped so newer sketches can add them
+        }
+        return r.Has(Record::LEGACY) || (r.Has(Record::TM) && (r.fields & Record::STREAMS) != 0);
+    }
+
+    int FormatRecord(const Record &r, char *buf, size_t len)
+    {
+        int n = 0;
+        // like snprintf, counts what would have been written once buf is full
+        auto at = [&]() { return static_cast<size_t>(n) < len ? buf + n : nullptr; };
+        auto room = [&]() { return static_cast<size_t>(n) < len ? len - n : 0; };
+        for (const FieldName &f : FIELDS)
+            if (r.Has(f.bit))
+                n += std::snprintf(at(), room(), "%s%s:%u", n == 0 ? "" : " ", f.name, r.*f.member);
+        if (r.locked)
+            n += std::snprintf(at(), room(), n == 0 ? "L" : " L");
+        return n;
+    }
+}
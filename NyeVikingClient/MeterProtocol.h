@@ -0,0 +1,140 @@
+#pragma once
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/* The text protocol on the PowerMeter sketch's serial port.
+** After "P ON" (average) or "P PEAK" the sketch sends lines like this one
+**      Vf:1234 Vr:56 Pf:12800 Pr:25 Sw:165 L
+** at most every 100 msec for OUTPUT_TIMEOUT_MSEC (10 seconds.)
+**      Vf and Vr are the averaged forward and reflected voltages, calibrated only to each other.
+**      Pf and Pr are power in units of 1/128 watt.
+**      Sw is the SWR the sketch's meter shows, per its SWRMODE, times 128. 1 means no forward power.
+**         Sketches before SWRMODE don't send it.
+**      Tm is the sketch's micros() when the record was taken. It wraps every 71.6 minutes.
+**         The sketch answers "PING=n" with "PONG=n Tm:<micros>" so the host can map Tm to its
+**         own clock. See ClockSync. Sketches before PING send neither.
+**      L is present only when the ALO lock out is active.
+** After "SUB x=n" the sketch also sends stream x every n'th 100 msec update, and every stream
+** due on an update goes on one line, with Tm:
+**      Fa:12800 Ra:25 Fp:25600 Rp:51 Fh:25600 Rh:51 Sw:165 Ls:6 Ws:5 Tm:81234567
+**      A   Fa Ra   average watts, like Pf and Pr after P ON
+**      P   Fp Rp   peak watts, like Pf and Pr after P PEAK
+**      H   Fh Rh   the highest peak since the stream was last sent
+**      S   Sw      as above
+**      L   Ls      LockSense bits
+**      W   Ws      Switches bits
+** "SUB x=0" stops x. "P OFF" stops everything. Subscriptions time out with P ON, and any of
+** those commands restarts the timeout for all of them.
+** The sketch answers "RECGET" with a binary frame: the line "BIN n", ended by a lone LF, then n bytes.
+** See namespace recorder in the sketch for what is in them.
+** Any other line on the port (the setup() banner, command responses) is passed through as text. */
+
+namespace NyeViking {
+
+    const unsigned DeviceOutputTimeoutMsec = 10000; // Comm::OUTPUT_TIMEOUT_MSEC in the sketch
+    const unsigned KeepAliveMsec = DeviceOutputTimeoutMsec / 2;
+    const unsigned WattsToDisplay = 128; // DisplayPower_t units per watt
+    const unsigned SwrScale = 128; // SWR_SCALE in the sketch
+    const unsigned InfiniteSwr = 100; // INFINITE_SWR in the sketch
+
+    // the x in SUB x=n
+    enum class Stream : char { AVERAGE = 'A', PEAK = 'P', HOLD = 'H', SWR = 'S', LOCK = 'L', SWITCHES = 'W' };
+    // "x=n" as on the command line. false if x isn't a Stream letter (either case) or n isn't 0-255
+    bool ParseSubscription(const char *, Stream &, unsigned &decimation);
+    namespace LockSense { enum { ALO_LOCK = 1, RF_SENSE = 2, LAMPS = 4 }; }
+    namespace Switches { enum { PANEL_MASK = 3, PANEL_PEAK_HOLD = 0, PANEL_PEAK = 1, PANEL_AVERAGE = 2,
+        FORWARD = 4, ALO_SWR = 8 }; }
+
+    struct Record
+    {
+        // a bit per field, in the order FormatRecord writes them
+        enum Field {
+            VF = 1 << 0, VR = 1 << 1, PF = 1 << 2, PR = 1 << 3,
+            FA = 1 << 4, RA = 1 << 5, FP = 1 << 6, RP = 1 << 7, FH = 1 << 8, RH = 1 << 9,
+            SW = 1 << 10, LS = 1 << 11, WS = 1 << 12, TM = 1 << 13,
+            LEGACY = VF | VR | PF | PR, // what P ON and P PEAK always send
+            STREAMS = FA | RA | FP | RP | FH | RH | SW | LS | WS,
+        };
+        uint32_t Vf = 0;
+        uint32_t Vr = 0;
+        uint32_t Pf = 0;
+        uint32_t Pr = 0;
+        uint32_t Fa = 0;
+        uint32_t Ra = 0;
+        uint32_t Fp = 0;
+        uint32_t Rp = 0;
+        uint32_t Fh = 0;
+        uint32_t Rh = 0;
+        uint32_t Sw = 0; // zero if the sketch didn't send it
+        uint32_t Ls = 0;
+        uint32_t Ws = 0;
+        uint32_t Tm = 0; // the sketch's micros()
+        unsigned fields = 0; // Field bits for what the line had
+        bool locked = false;
+
+        bool Has(unsigned f) const { return (fields & f) == f; }
+
+        double ForwardWatts() const { return static_cast<double>(Pf) / WattsToDisplay; }
+        double ReflectedWatts() const { return static_cast<double>(Pr) / WattsToDisplay; }
+        // SWR from the voltages: (Vf + Vr) / (Vf - Vr).
+        // NaN with no forward voltage, infinity if Vr >= Vf
+        double Swr() const;
+        // SWR from the Sw field, which may be gated or PEP per the sketch's SWRMODE.
+        // NaN if absent or with no forward power, infinity at the sketch's InfiniteSwr
+        double MeterSwr() const;
+    };
+
+    /* Writes r as the sketch would have, fields in Field order. Returns what snprintf does */
+    int FormatRecord(const Record &r, char *buf, size_t len);
+
+    /* RecordParser
+    ** Feed it bytes as they arrive from the port, in chunks of any size.
+    ** It calls back once per complete line. Lines are assembled in a fixed buffer
+    ** and tokenized in place: nothing is allocated per line or per record.
+    ** A BIN frame is collected whole and passed to the binary handler. */
+    class RecordParser
+    {
+    public:
+        typedef std::function<void(const Record &)> RecordHandler_t;
+        typedef std::function<void(const char *, size_t)> TextHandler_t;
+        typedef std::function<void(const uint8_t *, size_t)> BinaryHandler_t;
+
+        RecordParser();
+        void SetRecordHandler(RecordHandler_t h) { m_onRecord = h; }
+        void SetTextHandler(TextHandler_t h) { m_onText = h; }
+        void SetBinaryHandler(BinaryHandler_t h) { m_onBinary = h; }
+
+        void Feed(const char *p, size_t n);
+        void Reset() { m_len = 0; m_overflow = false; }
+
+        unsigned long RecordCount() const { return m_records; }
+        unsigned long ErrorCount() const { return m_errors; }
+
+        // parse one line (without its terminator.) true if it is a record: either all
+        // of Record::LEGACY, or Tm with any of Record::STREAMS
+        static bool ParseLine(const char *line, size_t len, Record &r);
+
+    protected:
+        void EndOfLine(char terminator);
+
+        enum { MAX_LINE = 128, MAX_BINARY = 4096 };
+        char m_line[MAX_LINE];
+        size_t m_len;
+        bool m_overflow;
+        unsigned long m_records;
+        unsigned long m_errors;
+        RecordHandler_t m_onRecord;
+        TextHandler_t m_onText;
+        BinaryHandler_t m_onBinary;
+        std::vector<uint8_t> m_binary; // the BIN frame so far
+        size_t m_binaryLeft;
+    };
+}
@@ -0,0 +1,137 @@
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include "SerialPort.h"
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace NyeViking {
+
+    namespace {
+        speed_t BaudToSpeed(unsigned long baud)
+        {
+            switch (baud)
+            {
+            case 9600: return B9600;
+            case 19200: return B19200;
+            case 38400: return B38400;
+            case 57600: return B57600;
+            case 115200: return B115200;
+            default:
+                throw std::system_error(EINVAL, std::generic_category(), "unsupported baud rate");
+            }
+        }
+    }
+
+    SerialPort::SerialPort(const std::string &device, unsigned long baud) : m_fd(-1)
+    {
+        Open(device, baud);
+    }
+
+    SerialPort::~SerialPort()
+    {
+        Close();
+    }
+
+    SerialPort::SerialPort(SerialPort &&other) : m_fd(other.m_fd), m_device(std::move(other.m_device))
+    {
+        other.m_fd = -1;
+    }
+
+    SerialPort &SerialPort::operator = (SerialPort &&other)
+    {
+        if (this != &other)
+        {
+            Close();
+            m_fd = other.m_fd;
+            m_device = std::move(other.m_device);
+            other.m_fd = -1;
+        }
+        return *this;
+    }
+
+    void SerialPort::Open(const std::string &device, unsigned long baud)
+    {
+        Close();
+        int fd = ::open(device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), device);
+        struct termios tio;
+        if (::tcgetattr(fd, &tio) != 0)
+        {
+            int e = errno;
+            ::close(fd);
+            throw std::system_error(e, std::generic_category(), device);
+        }
+        ::cfmakeraw(&tio);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tio.c_cflag &= ~(CRTSCTS | CSTOPB | PARENB);
+        tio.c_cc[VMIN] = 0;
+        tio.c_cc[VTIME] = 0;
+        speed_t speed = BaudToSpeed(baud);
+        ::cfsetispeed(&tio, speed);
+        ::cfsetospeed(&tio, speed);
+        if (::tcsetattr(fd, TCSANOW, &tio) != 0)
+        {
+            int e = errno;
+            ::close(fd);
+            throw std::system_error(e, std::generic_category(), device);
+        }
+        m_fd = fd;
+        m_device = device;
+    }
+
+    void SerialPort::Close()
+    {
+        if (m_fd >= 0)
+            ::close(m_fd);
+        m_fd = -1;
+    }
+
+    long SerialPort::Read(char *buf, size_t len)
+    {
+        if (m_fd < 0)
+            return -1;
+        ssize_t n = ::read(m_fd, buf, len);
+        if (n >= 0)
+            return n; // with VMIN and VTIME zero, a tty returns zero when it has nothing
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return 0;
+        return -1;
+    }
+
+    bool SerialPort::WriteLine(const char *s)
+    {
+        if (m_fd < 0)
+            return false;
+        // the sketch takes commands up to 18 characters (cmd::MAX_LINE_LEN). These are short
+        char buf[64];
+        size_t len = ::strlen(s);
+        if (len > sizeof(buf) - 1)
+            len = sizeof(buf) - 1;
+        ::memcpy(buf, s, len);
+        buf[len++] = '\n';
+        size_t sent = 0;
+        while (sent < len)
+        {
+            ssize_t n = ::write(m_fd, buf + sent, len - sent);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return true; // output full. The next keep alive will try again
+                return false;
+            }
+            sent += n;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <cstddef>
+#include <string>
+
+namespace NyeViking {
+
+    /* SerialPort
+    ** termios serial port (or pseudo terminal) in raw mode, non-blocking.
+    ** Open failures throw std::system_error. */
+    class SerialPort
+    {
+    public:
+        static const unsigned long DefaultBaud = 38400; // SERIAL_BAUD in the sketch
+
+        SerialPort() : m_fd(-1) {}
+        explicit SerialPort(const std::string &device, unsigned long baud = DefaultBaud);
+        ~SerialPort();
+        SerialPort(const SerialPort &) = delete;
+        SerialPort &operator = (const SerialPort &) = delete;
+        SerialPort(SerialPort &&);
+        SerialPort &operator = (SerialPort &&);
+
+        void Open(const std::string &device, unsigned long baud = DefaultBaud);
+        void Close();
+        bool IsOpen() const { return m_fd >= 0; }
+        int Fd() const { return m_fd; }
+        const std::string &Device() const { return m_device; }
+
+        // returns bytes read, zero if none available, -1 if the port is gone
+        long Read(char *buf, size_t len);
+        // writes s followed by newline. false if the port is gone
+        bool WriteLine(const char *s);
+
+    protected:
+        int m_fd;
+        std::string m_device;
+    };
+}
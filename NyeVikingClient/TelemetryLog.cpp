@@ -0,0 +1,441 @@
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include "TelemetryLog.h"
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace NyeViking {
+
+    namespace {
+        const uint32_t RAW_MAGIC = 0x4E56524Cu; // "NVRL"
+        const uint32_t TIER_MAGIC = 0x4E56544Cu; // "NVTL"
+        const size_t MIN_MAP = 1 << 16;
+
+        std::system_error Error(const std::string &what)
+        {
+            return std::system_error(errno, std::generic_category(), what);
+        }
+
+        int64_t FloorTo(int64_t v, int64_t p)
+        {
+            int64_t r = v / p * p;
+            return r > v ? r - p : r;
+        }
+    }
+
+    MappedFile::~MappedFile()
+    {
+        Close();
+    }
+
+    void MappedFile::Open(const std::string &path, uint32_t magic, size_t elemSize, bool writable)
+    {
+        Close();
+        m_path = path;
+        m_elemSize = elemSize;
+        m_writable = writable;
+        m_fd = ::open(path.c_str(), writable ? (O_RDWR | O_CREAT | O_CLOEXEC) : (O_RDONLY | O_CLOEXEC), 0644);
+        if (m_fd < 0)
+            throw Error(path);
+        struct stat st;
+        if (::fstat(m_fd, &st) != 0)
+            throw Error(path);
+        size_t len = static_cast<size_t>(st.st_size);
+        bool created = len == 0;
+        if (created)
+        {
+            if (!writable)
+                throw std::system_error(ENOENT, std::generic_category(), path);
+            len = MIN_MAP;
+            if (::ftruncate(m_fd, len) != 0)
+                throw Error(path);
+        }
+        else if (len < HEADER_SIZE)
+            throw std::system_error(EINVAL, std::generic_category(), path + " is truncated");
+        Map(len);
+        if (created)
+        {
+            Header()->magic = magic;
+            Header()->elemSize = static_cast<uint32_t>(elemSize);
+            Header()->count = 0;
+        }
+        else if (Header()->magic != magic || Header()->elemSize != elemSize)
+            throw std::system_error(EINVAL, std::generic_category(), path + " is not the expected format");
+    }
+
+    void MappedFile::Map(size_t len)
+    {
+        if (m_map != nullptr)
+            ::munmap(m_map, m_mapLen);
+        m_map = nullptr;
+        void *p = ::mmap(nullptr, len, m_writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, m_fd, 0);
+        if (p == MAP_FAILED)
+            throw Error(m_path);
+        m_map = static_cast<char *>(p);
+        m_mapLen = len;
+    }
+
+    void MappedFile::Close()
+    {
+        if (m_map != nullptr)
+            ::munmap(m_map, m_mapLen);
+        m_map = nullptr;
+        m_mapLen = 0;
+        if (m_fd >= 0)
+            ::close(m_fd);
+        m_fd = -1;
+    }
+
+    void *MappedFile::Append()
+    {
+        size_t needed = HEADER_SIZE + (Count() + 1) * m_elemSize;
+        if (needed > m_mapLen)
+        {
+            size_t len = m_mapLen * 2;
+            while (len < needed)
+                len *= 2;
+            if (::ftruncate(m_fd, len) != 0)
+                throw Error(m_path);
+            Map(len);
+        }
+        void *p = At(Count());
+        ::memset(p, 0, m_elemSize);
+        return p;
+    }
+
+    void MappedFile::Sync()
+    {
+        if (m_map != nullptr && ::msync(m_map, m_mapLen, MS_ASYNC) != 0)
+            throw Error(m_path);
+    }
+
+    const int64_t TelemetryLog::TierMsec[NUM_TIERS] = { 1000, 60 * 1000, 60 * 60 * 1000 };
+
+    uint16_t TelemetryLog::EncodeSwr(double swr)
+    {
+        if (std::isnan(swr))
+            return SWR_NONE;
+        double v = swr * SWR_SCALE + 0.5;
+        if (!(v < SWR_INFINITE))
+            return SWR_INFINITE;
+        if (v < SWR_SCALE)
+            v = SWR_SCALE;
+        return static_cast<uint16_t>(v);
+    }
+
+    double TelemetryLog::DecodeSwr(uint16_t v)
+    {
+        if (v == SWR_NONE)
+            return std::nan("");
+        if (v == SWR_INFINITE)
+            return INFINITY;
+        return static_cast<double>(v) / SWR_SCALE;
+    }
+
+    void TelemetryLog::Rollup::Add(const Entry &e)
+    {
+        if (count == 0)
+        {
+            PfMin = PfMax = e.Pf;
+            PrMin = PrMax = e.Pr;
+        }
+        else
+        {
+            if (e.Pf < PfMin) PfMin = e.Pf;
+            if (e.Pf > PfMax) PfMax = e.Pf;
+            if (e.Pr < PrMin) PrMin = e.Pr;
+            if (e.Pr > PrMax) PrMax = e.Pr;
+        }
+        endMsec = e.msec;
+        count += 1;
+        PfSum += e.Pf;
+        PrSum += e.Pr;
+        if (e.locked)
+            lockCount += 1;
+        if (e.swr != SWR_NONE)
+        {
+            if (swrMin == SWR_NONE || e.swr < swrMin)
+                swrMin = e.swr;
+            if (e.swr > swrMax)
+                swrMax = e.swr;
+            if (e.swr != SWR_INFINITE)
+            {
+                swrCount += 1;
+                swrSum += e.swr;
+            }
+        }
+    }
+
+    void TelemetryLog::Rollup::Merge(const Rollup &o)
+    {
+        if (o.count == 0)
+            return;
+        if (count == 0)
+        {
+            *this = o;
+            return;
+        }
+        if (o.startMsec < startMsec) startMsec = o.startMsec;
+        if (o.endMsec > endMsec) endMsec = o.endMsec;
+        count += o.count;
+        lockCount += o.lockCount;
+        swrCount += o.swrCount;
+        if (o.PfMin < PfMin) PfMin = o.PfMin;
+        if (o.PfMax > PfMax) PfMax = o.PfMax;
+        if (o.PrMin < PrMin) PrMin = o.PrMin;
+        if (o.PrMax > PrMax) PrMax = o.PrMax;
+        if (o.swrMin != SWR_NONE && (swrMin == SWR_NONE || o.swrMin < swrMin)) swrMin = o.swrMin;
+        if (o.swrMax > swrMax) swrMax = o.swrMax;
+        PfSum += o.PfSum;
+        PrSum += o.PrSum;
+        swrSum += o.swrSum;
+    }
+
+    TelemetryLog::TelemetryLog(const std::string &directory, bool writable)
+    {
+        static_assert(sizeof(Rollup) == 80, "Rollup is a file format");
+        if (writable && ::mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+            throw Error(directory);
+        static const char * const names[NUM_TIERS] = { "/1s.nvl", "/1m.nvl", "/1h.nvl" };
+        m_raw.Open(directory + "/raw.nvl", RAW_MAGIC, sizeof(Block), writable);
+        for (int t = 0; t < NUM_TIERS; t++)
+            m_tiers[t].Open(directory + names[t], TIER_MAGIC, sizeof(Rollup), writable);
+    }
+
+    TelemetryLog::~TelemetryLog()
+    {}
+
+    void TelemetryLog::Append(int64_t msec, const Record &r)
+    {
+        Entry e;
+        e.msec = msec;
+        e.Pf = r.Pf;
+        e.Pr = r.Pr;
+        e.swr = EncodeSwr(r.Swr());
+        e.locked = r.locked;
+        Append(e);
+    }
+
+    void TelemetryLog::Append(const Entry &entry)
+    {
+        Entry e = entry;
+        uint64_t n = m_raw.Count();
+        if (n > 0)
+        {   // the file's, not this process's, so an earlier run's clock counts too.
+            // Rollups and blocks are searched by time, so they must stay in order
+            const Block &last = *static_cast<const Block *>(m_raw.At(n - 1));
+            if (e.msec < last.lastMsec)
+                e.msec = last.lastMsec;
+        }
+        if (n == 0 || !AppendToBlock(*static_cast<Block *>(m_raw.At(n - 1)), e))
+        {
+            Block *b = static_cast<Block *>(m_raw.Append());
+            b->firstMsec = e.msec;
+            AppendToBlock(*b, e); // always fits an empty block
+            m_raw.Commit();
+        }
+
+        for (int t = 0; t < NUM_TIERS; t++)
+        {
+            int64_t start = FloorTo(e.msec, TierMsec[t]);
+            uint64_t c = m_tiers[t].Count();
+            Rollup *r = c > 0 ? static_cast<Rollup *>(m_tiers[t].At(c - 1)) : nullptr;
+            if (r == nullptr || r->startMsec != start)
+            {
+                r = static_cast<Rollup *>(m_tiers[t].Append());
+                r->startMsec = start;
+                r->Add(e);
+                m_tiers[t].Commit();
+            }
+            else
+                r->Add(e);
+        }
+    }
+
+    bool TelemetryLog::AppendToBlock(Block &b, const Entry &e)
+    {
+        uint32_t i = b.count;
+        if (i >= BLOCK_RECORDS)
+            return false;
+        int64_t dt = i == 0 ? 0 : e.msec - b.lastMsec;
+        if (dt < 0 || dt > UINT32_MAX)
+            return false;
+        int64_t dPf = static_cast<int64_t>(e.Pf) - b.lastPf;
+        int64_t dPr = static_cast<int64_t>(e.Pr) - b.lastPr;
+        bool escDt = dt >= DT_ESCAPE;
+        bool escPf = dPf <= ESCAPE || dPf > INT16_MAX;
+        bool escPr = dPr <= ESCAPE || dPr > INT16_MAX;
+        if (b.exceptions + escDt + escPf + escPr > BLOCK_EXCEPTIONS)
+            return false;
+
+        if (escDt)
+        {
+            b.dt[i] = DT_ESCAPE;
+            b.exception[b.exceptions++] = static_cast<uint32_t>(dt);
+        }
+        else
+            b.dt[i] = static_cast<uint16_t>(dt);
+        if (escPf)
+        {
+            b.dPf[i] = ESCAPE;
+            b.exception[b.exceptions++] = e.Pf;
+        }
+        else
+            b.dPf[i] = static_cast<int16_t>(dPf);
+        if (escPr)
+        {
+            b.dPr[i] = ESCAPE;
+            b.exception[b.exceptions++] = e.Pr;
+        }
+        else
+            b.dPr[i] = static_cast<int16_t>(dPr);
+        b.dSwr[i] = static_cast<int16_t>(static_cast<uint16_t>(e.swr - b.lastSwr));
+        b.flags[i] = e.locked ? 1 : 0;
+        b.lastPf = e.Pf;
+        b.lastPr = e.Pr;
+        b.lastSwr = e.swr;
+        b.lastMsec = e.msec;
+        b.count = i + 1; // last, so a reader never sees a partial record
+        return true;
+    }
+
+    void TelemetryLog::Sync()
+    {
+        m_raw.Sync();
+        for (auto &t : m_tiers)
+            t.Sync();
+    }
+
+    uint64_t TelemetryLog::RawCount() const
+    {
+        uint64_t n = 0;
+        for (uint64_t i = 0; i < m_raw.Count(); i++)
+            n += static_cast<const Block *>(m_raw.At(i))->count;
+        return n;
+    }
+
+    void TelemetryLog::DecodeBlock(const Block &b, int64_t from, int64_t to,
+        const std::function<void(const Entry &)> &f) const
+    {
+        Entry e;
+        e.msec = b.firstMsec;
+        e.Pf = e.Pr = 0;
+        e.swr = 0;
+        uint32_t x = 0;
+        for (uint32_t i = 0; i < b.count; i++)
+        {
+            if (b.dt[i] == DT_ESCAPE)
+                e.msec += b.exception[x++];
+            else
+                e.msec += b.dt[i];
+            if (b.dPf[i] == ESCAPE)
+                e.Pf = b.exception[x++];
+            else
+                e.Pf += b.dPf[i];
+            if (b.dPr[i] == ESCAPE)
+                e.Pr = b.exception[x++];
+            else
+                e.Pr += b.dPr[i];
+            e.swr = static_cast<uint16_t>(e.swr + static_cast<uint16_t>(b.dSwr[i]));
+            e.locked = b.flags[i] != 0;
+            if (e.msec >= to)
+                return;
+            if (e.msec >= from)
+                f(e);
+        }
+    }
+
+    void TelemetryLog::ForEach(int64_t from, int64_t to, const std::function<void(const Entry &)> &f) const
+    {
+        // binary search for the first block that ends at or after from
+        uint64_t lo = 0;
+        uint64_t hi = m_raw.Count();
+        while (lo < hi)
+        {
+            uint64_t mid = (lo + hi) / 2;
+            if (static_cast<const Block *>(m_raw.At(mid))->lastMsec < from)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        for (uint64_t i = lo; i < m_raw.Count(); i++)
+        {
+            const Block &b = *static_cast<const Block *>(m_raw.At(i));
+            if (b.firstMsec >= to)
+                break;
+            DecodeBlock(b, from, to, f);
+        }
+    }
+
+    uint64_t TelemetryLog::FirstRollupAtOrAfter(Tier t, int64_t msec) const
+    {
+        uint64_t lo = 0;
+        uint64_t hi = m_tiers[t].Count();
+        while (lo < hi)
+        {
+            uint64_t mid = (lo + hi) / 2;
+            if (GetRollup(t, mid).startMsec < msec)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    void TelemetryLog::ForEachRollup(Tier t, int64_t from, int64_t to,
+        const std::function<void(const Rollup &)> &f) const
+    {
+        for (uint64_t i = FirstRollupAtOrAfter(t, from); i < m_tiers[t].Count(); i++)
+        {
+            const Rollup &r = GetRollup(t, i);
+            if (r.startMsec >= to)
+                break;
+            f(r);
+        }
+    }
+
+    void TelemetryLog::SummarizeTier(int tier, int64_t from, int64_t to, Rollup &acc) const
+    {
+        if (from >= to)
+            return;
+        if (tier < 0)
+        {
+            ForEach(from, to, [&acc](const Entry &e)
+            {
+                Rollup one = Rollup();
+                one.startMsec = e.msec;
+                one.Add(e);
+                acc.Merge(one);
+            });
+            return;
+        }
+        int64_t p = TierMsec[tier];
+        int64_t first = FloorTo(from + p - 1, p); // whole periods are [first, last)
+        int64_t last = FloorTo(to, p);
+        if (first >= last)
+        {
+            SummarizeTier(tier - 1, from, to, acc);
+            return;
+        }
+        SummarizeTier(tier - 1, from, first, acc);
+        ForEachRollup(static_cast<Tier>(tier), first, last, [&acc](const Rollup &r) { acc.Merge(r); });
+        SummarizeTier(tier - 1, last, to, acc);
+    }
+
+    TelemetryLog::Rollup TelemetryLog::Summarize(int64_t from, int64_t to) const
+    {
+        Rollup acc = Rollup();
+        SummarizeTier(NUM_TIERS - 1, from, to, acc);
+        return acc;
+    }
+}
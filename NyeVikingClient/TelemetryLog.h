@@ -0,0 +1,167 @@
+#pragma once
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "MeterProtocol.h"
+
+namespace NyeViking {
+
+    /* MappedFile
+    ** A file of one fixed size header followed by an array of fixed size elements,
+    ** memory mapped, that grows as elements are appended. Growing remaps the file, so
+    ** hold indices, not pointers, across Append(). Errors throw std::system_error. */
+    class MappedFile
+    {
+    public:
+        MappedFile() : m_fd(-1), m_map(nullptr), m_mapLen(0), m_elemSize(0), m_writable(false) {}
+        ~MappedFile();
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator = (const MappedFile &) = delete;
+
+        // creates the file if needed. Throws if it exists with a different magic or element size
+        void Open(const std::string &path, uint32_t magic, size_t elemSize, bool writable);
+        void Close();
+
+        // a reader's mapping doesn't follow the writer's growth
+        uint64_t Count() const
+        {
+            uint64_t mapped = (m_mapLen - HEADER_SIZE) / m_elemSize;
+            return Header()->count < mapped ? Header()->count : mapped;
+        }
+        void *At(uint64_t i) { return m_map + HEADER_SIZE + i * m_elemSize; }
+        const void *At(uint64_t i) const { return m_map + HEADER_SIZE + i * m_elemSize; }
+        // new zeroed element at Count(), which the caller fills before calling Commit()
+        void *Append();
+        void Commit() { Header()->count += 1; }
+        void Sync();
+
+    protected:
+        struct FileHeader
+        {
+            uint32_t magic;
+            uint32_t elemSize;
+            uint64_t count; // committed elements
+        };
+        enum { HEADER_SIZE = 64 };
+        FileHeader *Header() { return reinterpret_cast<FileHeader *>(m_map); }
+        const FileHeader *Header() const { return reinterpret_cast<const FileHeader *>(m_map); }
+        void Map(size_t len);
+
+        int m_fd;
+        char *m_map;
+        size_t m_mapLen;
+        size_t m_elemSize;
+        bool m_writable;
+        std::string m_path;
+    };
+
+    /* TelemetryLog
+    ** Long term history of one meter's records, in a directory of four memory mapped files:
+    **  raw.nvl     Every record, in blocks of BLOCK_RECORDS. Within a block each field is its own
+    **              column of fixed width deltas from the previous record. A time or power delta that
+    **              doesn't fit 16 bits is an escape to a full width value in the block's exception column.
+    **  1s.nvl, 1m.nvl, 1h.nvl
+    **              Min, max and mean of the records in each second, minute and hour that has any.
+    **              These are maintained as records are appended.
+    ** The last rollup in each tier is the period in progress, updated in place.
+    ** Summarize() over a long range reads hour rollups for the whole hours in it, and only
+    ** goes to the finer tiers, or to the raw records, at its ends. */
+    class TelemetryLog
+    {
+    public:
+        enum Tier { TIER_SECOND, TIER_MINUTE, TIER_HOUR, NUM_TIERS };
+        static const int64_t TierMsec[NUM_TIERS];
+
+        static const uint16_t SWR_NONE = 0; // no forward power
+        static const uint16_t SWR_INFINITE = 0xFFFF;
+        static const unsigned SWR_SCALE = 1000; // Swr column is SWR times this
+        static uint16_t EncodeSwr(double swr);
+        static double DecodeSwr(uint16_t);
+
+        struct Entry
+        {
+            int64_t msec; // caller's clock. Append() moves one earlier than the log's last up to it
+            uint32_t Pf; // 1/128 W, as in Record
+            uint32_t Pr;
+            uint16_t swr; // EncodeSwr
+            bool locked;
+        };
+
+        struct Rollup
+        {
+            int64_t startMsec; // of the period. In a Summarize() result, of its earliest period
+            int64_t endMsec; // of the last record
+            uint32_t count;
+            uint32_t lockCount;
+            uint32_t swrCount; // records with a finite SWR
+            uint32_t PfMin, PfMax;
+            uint32_t PrMin, PrMax;
+            uint16_t swrMin, swrMax; // swrMax can be SWR_INFINITE
+            uint32_t reserved;
+            uint64_t PfSum, PrSum, swrSum;
+
+            void Add(const Entry &);
+            void Merge(const Rollup &);
+            double PfMean() const { return count ? static_cast<double>(PfSum) / count : 0; }
+            double PrMean() const { return count ? static_cast<double>(PrSum) / count : 0; }
+            double SwrMean() const { return swrCount ? static_cast<double>(swrSum) / swrCount / SWR_SCALE : 0; }
+        };
+
+        enum { BLOCK_RECORDS = 1024, BLOCK_EXCEPTIONS = BLOCK_RECORDS / 2 };
+
+        explicit TelemetryLog(const std::string &directory, bool writable = true);
+        ~TelemetryLog();
+
+        void Append(const Entry &);
+        void Append(int64_t msec, const Record &r);
+        void Sync();
+
+        uint64_t RawCount() const;
+        uint64_t RollupCount(Tier t) const { return m_tiers[t].Count(); }
+        const Rollup &GetRollup(Tier t, uint64_t i) const
+        { return *static_cast<const Rollup *>(m_tiers[t].At(i)); }
+
+        // Min/max/mean over records with msec in [from, to)
+        Rollup Summarize(int64_t from, int64_t to) const;
+        // each raw record with msec in [from, to)
+        void ForEach(int64_t from, int64_t to, const std::function<void(const Entry &)> &) const;
+        // each rollup of tier t whose period starts in [from, to)
+        void ForEachRollup(Tier t, int64_t from, int64_t to, const std::function<void(const Rollup &)> &) const;
+
+    protected:
+        struct Block
+        {
+            int64_t firstMsec;
+            int64_t lastMsec;
+            uint32_t count;
+            uint32_t exceptions;
+            uint32_t lastPf, lastPr; // for the next delta
+            uint16_t lastSwr;
+            uint16_t reserved[3];
+            // columns
+            uint16_t dt[BLOCK_RECORDS]; // msec since previous record, or DT_ESCAPE
+            int16_t dPf[BLOCK_RECORDS];
+            int16_t dPr[BLOCK_RECORDS];
+            int16_t dSwr[BLOCK_RECORDS]; // modulo 2**16
+            uint8_t flags[BLOCK_RECORDS];
+            uint32_t exception[BLOCK_EXCEPTIONS]; // in record order, dt then Pf then Pr
+        };
+        static const uint16_t DT_ESCAPE = UINT16_MAX;
+        static const int16_t ESCAPE = INT16_MIN;
+
+        bool AppendToBlock(Block &, const Entry &);
+        void DecodeBlock(const Block &, int64_t from, int64_t to, const std::function<void(const Entry &)> &) const;
+        uint64_t FirstRollupAtOrAfter(Tier t, int64_t msec) const;
+        void SummarizeTier(int tier, int64_t from, int64_t to, Rollup &) const;
+
+        MappedFile m_raw;
+        MappedFile m_tiers[NUM_TIERS];
+    };
+}
@@ -0,0 +1,121 @@
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Aggregator.h"
+
+/* nvaggd
+** One process, one thread, for the serial ports of any number of PowerMeter consoles.
+** usage: nvaggd [-p] [-S x=n ...] -s <socket> [<name>=]<device> ...
+**      -p  peak power instead of average
+**      -S  also subscribe every meter to stream x, every n'th 100 msec. See MeterProtocol.h
+**      -s  unix domain socket on which to publish the merged feed
+** A station's name defaults to the last component of its device path.
+** The feed is described in Aggregator.h. For example:
+**      nvaggd -s /tmp/nvagg station1=/dev/ttyUSB0 station2=/dev/ttyUSB1
+**      socat - UNIX-CONNECT:/tmp/nvagg */
+
+namespace {
+    volatile sig_atomic_t Stop;
+    void OnSignal(int) { Stop = 1; }
+
+    void Usage()
+    {
+        std::fprintf(stderr, "usage: nvaggd [-p] [-S x=n ...] -s <socket> [<name>=]<device> ...\n");
+    }
+
+    const int STOP_CHECK_MSEC = 250;
+}
+
+int main(int argc, char **argv)
+{
+    using namespace NyeViking;
+    Meter::Output output = Meter::Output::AVERAGE;
+    const char *socketPath = nullptr;
+    std::vector<std::pair<Stream, unsigned>> subscriptions;
+    int first = argc;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "-p") == 0)
+            output = Meter::Output::PEAK;
+        else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            socketPath = argv[++i];
+        else if (std::strcmp(argv[i], "-S") == 0 && i + 1 < argc)
+        {
+            Stream s;
+            unsigned n;
+            if (!ParseSubscription(argv[++i], s, n))
+            {
+                Usage();
+                return 2;
+            }
+            subscriptions.emplace_back(s, n);
+        }
+        else if (argv[i][0] != '-')
+        {
+            first = i;
+            break;
+        }
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+    if (socketPath == nullptr || first == argc)
+    {
+        Usage();
+        return 2;
+    }
+
+    std::signal(SIGINT, OnSignal);
+    std::signal(SIGTERM, OnSignal);
+    std::signal(SIGPIPE, SIG_IGN);
+    try {
+        Aggregator agg(output);
+        for (const auto &s : subscriptions)
+            agg.Subscribe(s.first, s.second);
+        for (int i = first; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            std::string name;
+            std::string device;
+            size_t eq = arg.find('=');
+            if (eq != std::string::npos)
+            {
+                name = arg.substr(0, eq);
+                device = arg.substr(eq + 1);
+            }
+            else
+            {
+                device = arg;
+                size_t slash = arg.rfind('/');
+                name = slash == std::string::npos ? arg : arg.substr(slash + 1);
+            }
+            if (name.empty() || device.empty() || name.find_first_of(" \t#") != std::string::npos)
+            {
+                Usage();
+                return 2;
+            }
+            agg.AddStation(name, device);
+        }
+        agg.Listen(socketPath);
+        while (!Stop)
+            agg.RunOnce(STOP_CHECK_MSEC);
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "nvaggd: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
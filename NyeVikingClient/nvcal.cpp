@@ -0,0 +1,355 @@
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <poll.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+#include "Calibration.h"
+#include "MeterClient.h"
+
+/* nvcal
+** Multipoint power calibration of a PowerMeter console. See namespace calibrate in the sketch.
+** usage: nvcal [-l] [-n] <device>
+**      -l  capture no points. Fit the ones already in the sketch's EEPROM
+**      -n  print the fit, but don't send it
+** For each point, key a steady carrier into a 50 ohm load and type the reference wattmeter's
+** reading. The sketch averages for two seconds. Reverse the coupler for reflected points.
+** An empty line fits each direction through every point the sketch has, and stores the fit,
+** one command at a time. It then lists the sketch's calibration again, and exits 1 if that
+** isn't the fit it sent. */
+
+namespace {
+    volatile sig_atomic_t Stop;
+    void OnSignal(int) { Stop = 1; }
+
+    void Usage()
+    {
+        std::fprintf(stderr, "usage: nvcal [-l] [-n] <device>\n");
+    }
+
+    typedef NyeViking::Meter::Clock_t Clock_t;
+    const int BootMsec = 3000; // opening the port may reset the sketch. setup() ends with SWRMODE=
+    const int AnswerMsec = 5000; // the capture takes 2 seconds
+    const unsigned CalPoints = 8; // CAL_POINTS in the sketch
+
+    class Session
+    {
+    public:
+        Session(NyeViking::Meter &meter, bool capture, bool store)
+            : m_meter(meter), m_capture(capture), m_store(store), m_state(BOOTING), m_point(0),
+            m_deadline(Clock_t::now() + std::chrono::milliseconds(BootMsec))
+        {
+            m_meter.SetTextHandler([this](const char *p, size_t n) { OnText(p, n); });
+        }
+
+        bool Done() const { return m_state == DONE; }
+        bool Failed() const { return m_failed; }
+        bool WantsInput() const { return m_state == PROMPTED; }
+
+        int PollMsec(Clock_t::time_point now) const
+        {
+            if (m_state == PROMPTED)
+                return m_meter.PollMsec(now);
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(m_deadline - now).count();
+            return static_cast<int>(std::max<long long>(0, std::min<long long>(left, m_meter.PollMsec(now))));
+        }
+
+        void Check(Clock_t::time_point now)
+        {
+            if (m_state == PROMPTED || m_state == DONE || now < m_deadline)
+                return;
+            if (m_state == BOOTING)
+                Begin();
+            else
+            {
+                std::fprintf(stderr, "nvcal: no answer from %s\n", m_meter.Device().c_str());
+                if (m_state == CAPTURING)
+                    Prompt();
+                else
+                    Finish(true);
+            }
+        }
+
+        void OnInput(const char *line)
+        {
+            while (*line == ' ' || *line == '\t')
+                line++;
+            if (*line == 0 || *line == '\n')
+            {
+                List(LISTING);
+                return;
+            }
+            char *end;
+            double watts = std::strtod(line, &end);
+            if (end == line || watts <= 0 || watts > 100000)
+            {
+                std::printf("watts, e.g. 12.5\n");
+                Prompt();
+                return;
+            }
+            char cmd[24]; // the sketch takes 18 characters
+            std::snprintf(cmd, sizeof(cmd), watts < 1000 ? "CAL %u=%.2f" : "CAL %u=%.0f", m_point, watts);
+            m_meter.Command(cmd);
+            Expect(CAPTURING, AnswerMsec);
+        }
+
+    protected:
+        enum State { BOOTING, PROMPTED, CAPTURING, LISTING, STORING, VERIFYING, DONE };
+
+        void Begin()
+        {
+            if (m_capture)
+                Prompt();
+            else
+                List(LISTING);
+        }
+
+        void Prompt()
+        {
+            if (m_point >= CalPoints)
+            {
+                List(LISTING);
+                return;
+            }
+            std::printf("point %u: reference watts, or Enter to fit: ", m_point);
+            std::fflush(stdout);
+            m_state = PROMPTED;
+        }
+
+        void List(State s)
+        {
+            m_points.clear();
+            m_meter.Command("CAL");
+            Expect(s, AnswerMsec);
+        }
+
+        void Expect(State s, int msec)
+        {
+            m_state = s;
+            m_deadline = Clock_t::now() + std::chrono::milliseconds(msec);
+        }
+
+        void Finish(bool failed)
+        {
+            m_failed = failed;
+            m_state = DONE;
+        }
+
+        void OnText(const char *p, size_t n)
+        {
+            if (m_state == BOOTING)
+            {
+                if (n >= 8 && std::strncmp(p, "SWRMODE=", 8) == 0)
+                    Begin();
+                return;
+            }
+            NyeViking::CalibrationPoint point;
+            NyeViking::CalibrationFit fit;
+            if (m_state == CAPTURING)
+            {
+                char prefix[16];
+                int len = std::snprintf(prefix, sizeof(prefix), "CAL %u ", m_point);
+                if (n < static_cast<size_t>(len) || std::strncmp(p, prefix, len) != 0)
+                    return;
+                std::printf("%.*s\n", static_cast<int>(n), p);
+                if (NyeViking::ParseCalibrationPoint(p, n, point))
+                    m_point += 1;
+                Prompt();
+            }
+            else if (m_state == LISTING)
+            {
+                if (NyeViking::ParseCalibrationPoint(p, n, point))
+                    m_points.push_back(point);
+                else if (NyeViking::ParseCalibrationFit(p, n, fit) && fit.reflected)
+                    Fit(); // CALR is the last line
+            }
+            else if (m_state == STORING)
+            {   // each CALG, CALO or CALC is answered with the whole listing
+                if (NyeViking::ParseCalibrationFit(p, n, fit) && fit.reflected)
+                    Store();
+            }
+            else if (m_state == VERIFYING)
+            {
+                if (!NyeViking::ParseCalibrationFit(p, n, fit))
+                    return;
+                std::printf("%.*s\n", static_cast<int>(n), p);
+                m_stored[fit.reflected ? 1 : 0] = fit;
+                if (fit.reflected)
+                    Verify();
+            }
+        }
+
+        // the next of m_commands, one at a time. The sketch's receive buffer is 64 bytes
+        void Store()
+        {
+            if (m_commands.empty())
+            {
+                List(VERIFYING);
+                return;
+            }
+            m_meter.Command(m_commands.front().c_str());
+            m_commands.erase(m_commands.begin());
+            Expect(STORING, AnswerMsec);
+        }
+
+        void Verify()
+        {
+            bool ok = true;
+            for (const auto &f : m_fits)
+            {
+                const NyeViking::CalibrationFit &s = m_stored[f.reflected ? 1 : 0];
+                if (s.gain != f.gain || s.offset != f.offset || s.curve != f.curve)
+                {
+                    std::fprintf(stderr, "nvcal: the sketch has %s G:%ld O:%ld C:%ld, not the fit G:%ld O:%ld C:%ld\n",
+                        f.reflected ? "CALR" : "CALF", s.gain, s.offset, s.curve, f.gain, f.offset, f.curve);
+                    ok = false;
+                }
+            }
+            Finish(!ok);
+        }
+
+        void Fit()
+        {
+            m_fits.clear();
+            bool any = false;
+            for (int d = 0; d < 2; d++)
+            {
+                bool reflected = d != 0;
+                NyeViking::CalibrationFit fit;
+                if (!NyeViking::FitCalibration(m_points, reflected, fit))
+                {
+                    bool have = false;
+                    for (const auto &p : m_points)
+                        have = have || p.reflected == reflected;
+                    if (have)
+                        std::fprintf(stderr, "nvcal: %s points don't fit the sketch's calibration\n",
+                            reflected ? "reflected" : "forward");
+                    continue;
+                }
+                std::printf("%s: gain %.5f offset %ld curve %ld, from %u term%s\n",
+                    reflected ? "reflected" : "forward", fit.gain / 32768.0, fit.offset, fit.curve,
+                    fit.terms, fit.terms == 1 ? "" : "s");
+                std::printf("  point   reference W   uncalibrated W   calibrated W   error %%\n");
+                for (const auto &p : m_points)
+                {
+                    if (p.reflected != reflected)
+                        continue;
+                    double ref = static_cast<double>(p.watts) / NyeViking::WattsToDisplay;
+                    double cal = NyeViking::CalibratedWatts(fit, p);
+                    std::printf("  %5u %13.2f %16.2f %14.2f %9.2f\n", p.n, ref,
+                        static_cast<double>(p.nominal) / NyeViking::WattsToDisplay, cal,
+                        ref > 0 ? 100.0 * (cal - ref) / ref : 0.0);
+                }
+                if (m_store)
+                    for (const auto &c : NyeViking::FitCommands(fit))
+                        m_commands.push_back(c);
+                m_fits.push_back(fit);
+                any = true;
+            }
+            if (!any)
+            {
+                std::fprintf(stderr, "nvcal: no points to fit\n");
+                Finish(true);
+            }
+            else if (m_store)
+                Store();
+            else
+                Finish(false);
+        }
+
+        NyeViking::Meter &m_meter;
+        bool m_capture;
+        bool m_store;
+        State m_state;
+        bool m_failed = false;
+        unsigned m_point;
+        Clock_t::time_point m_deadline;
+        std::vector<NyeViking::CalibrationPoint> m_points;
+        std::vector<NyeViking::CalibrationFit> m_fits;
+        std::vector<std::string> m_commands; // not yet sent
+        NyeViking::CalibrationFit m_stored[2]; // as the sketch listed them. forward, reflected
+    };
+}
+
+int main(int argc, char **argv)
+{
+    using namespace NyeViking;
+    bool capture = true;
+    bool store = true;
+    const char *device = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "-l") == 0)
+            capture = false;
+        else if (std::strcmp(argv[i], "-n") == 0)
+            store = false;
+        else if (argv[i][0] != '-' && device == nullptr)
+            device = argv[i];
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+    if (device == nullptr)
+    {
+        Usage();
+        return 2;
+    }
+
+    std::signal(SIGINT, OnSignal);
+    std::signal(SIGTERM, OnSignal);
+    try {
+        Meter meter(device, Meter::Output::NONE);
+        Session session(meter, capture, store);
+        while (!Stop && !session.Done() && meter.IsOpen())
+        {
+            struct pollfd pfd[2];
+            pfd[0].fd = meter.Fd();
+            pfd[0].events = POLLIN;
+            pfd[0].revents = 0;
+            pfd[1].fd = 0;
+            pfd[1].events = POLLIN;
+            pfd[1].revents = 0;
+            nfds_t nfds = session.WantsInput() ? 2 : 1;
+            if (::poll(pfd, nfds, session.PollMsec(Clock_t::now())) < 0 && errno != EINTR)
+                break;
+            if (pfd[0].revents & (POLLERR | POLLNVAL | POLLHUP))
+                break;
+            if (!meter.Service())
+                break;
+            if (nfds == 2 && (pfd[1].revents & (POLLIN | POLLHUP)))
+            {
+                char line[64];
+                if (std::fgets(line, sizeof(line), stdin) == nullptr)
+                    session.OnInput(""); // end of input fits what there is
+                else
+                    session.OnInput(line);
+            }
+            session.Check(Clock_t::now());
+        }
+        if (!session.Done())
+        {
+            std::fprintf(stderr, "nvcal: %s closed\n", device);
+            return 1;
+        }
+        return session.Failed() ? 1 : 0;
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "nvcal: %s\n", e.what());
+        return 1;
+    }
+}
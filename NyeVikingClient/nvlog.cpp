@@ -0,0 +1,244 @@
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <exception>
+#include "MeterClient.h"
+#include "TelemetryLog.h"
+
+/* nvlog
+** Records a meter's readings into a TelemetryLog directory, and queries one.
+** usage:
+**  nvlog record [-p] <device> <dir>
+**      append every record from the meter, time stamped with the wall clock
+**  nvlog summary <dir> <from> <to>
+**      min/max/mean over the range
+**  nvlog series <dir> raw|1s|1m|1h <from> <to>
+**      one line per record or per rollup in the range
+** Times are seconds since 1970, or relative to now as -<n>s, -<n>m, -<n>h or -<n>d. */
+
+namespace {
+    using NyeViking::TelemetryLog;
+
+    volatile sig_atomic_t Stop;
+    void OnSignal(int) { Stop = 1; }
+
+    const int SYNC_INTERVAL_SECONDS = 10;
+
+    void Usage()
+    {
+        std::fprintf(stderr,
+            "usage: nvlog record [-p] <device> <dir>\n"
+            "       nvlog summary <dir> <from> <to>\n"
+            "       nvlog series <dir> raw|1s|1m|1h <from> <to>\n"
+            "times are seconds since 1970, or -<n>s|m|h|d before now\n");
+    }
+
+    int64_t NowMsec()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    bool ParseTime(const char *s, int64_t &msec)
+    {
+        char *end;
+        if (*s == '-')
+        {
+            long long n = std::strtoll(s + 1, &end, 10);
+            int64_t unit;
+            switch (*end)
+            {
+            case 's': unit = 1000; break;
+            case 'm': unit = 60 * 1000; break;
+            case 'h': unit = 60 * 60 * 1000; break;
+            case 'd': unit = 24 * 60 * 60 * 1000; break;
+            default: return false;
+            }
+            if (end == s + 1 || end[1] != 0)
+                return false;
+            msec = NowMsec() - n * unit;
+            return true;
+        }
+        double v = std::strtod(s, &end);
+        if (end == s || *end != 0)
+            return false;
+        msec = static_cast<int64_t>(v * 1000);
+        return true;
+    }
+
+    const char *TimeText(int64_t msec)
+    {
+        static char buf[32];
+        time_t t = static_cast<time_t>(msec / 1000);
+        struct tm tm;
+        ::localtime_r(&t, &tm);
+        size_t n = std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+        std::snprintf(buf + n, sizeof(buf) - n, ".%03d", static_cast<int>(msec % 1000));
+        return buf;
+    }
+
+    const char *SwrText(uint16_t swr)
+    {
+        static char buf[16];
+        double v = TelemetryLog::DecodeSwr(swr);
+        if (std::isnan(v))
+            return "-";
+        if (std::isinf(v))
+            return "infinite";
+        std::snprintf(buf, sizeof(buf), "%.2f", v);
+        return buf;
+    }
+
+    double Watts(double v)
+    {
+        return v / NyeViking::WattsToDisplay;
+    }
+
+    void PrintRollup(const TelemetryLog::Rollup &r)
+    {
+        std::printf("%s n=%u lock=%u Pf %.1f/%.1f/%.1f W Pr %.1f/%.1f/%.1f W",
+            TimeText(r.startMsec), r.count, r.lockCount,
+            Watts(r.PfMin), Watts(r.PfMean()), Watts(r.PfMax),
+            Watts(r.PrMin), Watts(r.PrMean()), Watts(r.PrMax));
+        if (r.swrMin != TelemetryLog::SWR_NONE)
+        {
+            std::printf(" SWR %s", SwrText(r.swrMin));
+            if (r.swrCount)
+                std::printf("/%.2f", r.SwrMean());
+            std::printf("/%s", SwrText(r.swrMax));
+        }
+        std::printf("\n");
+    }
+
+    int RecordMeter(int argc, char **argv)
+    {
+        using namespace NyeViking;
+        Meter::Output output = Meter::Output::AVERAGE;
+        int i = 0;
+        if (i < argc && std::strcmp(argv[i], "-p") == 0)
+        {
+            output = Meter::Output::PEAK;
+            i += 1;
+        }
+        if (argc - i != 2)
+        {
+            Usage();
+            return 2;
+        }
+        const char *device = argv[i];
+        TelemetryLog log(argv[i + 1]);
+        Meter meter(device, output);
+        int64_t lastSync = NowMsec();
+        meter.SetRecordHandler([&log, &lastSync, &meter](const Record &r)
+        {
+            int64_t now = NowMsec();
+            int64_t msec = now;
+            std::chrono::system_clock::time_point taken;
+            if (meter.RecordTime(r, taken))
+                msec = std::chrono::duration_cast<std::chrono::milliseconds>(taken.time_since_epoch()).count();
+            // the clock fit moves a little as PONGs come in. Append() keeps the log in order
+            log.Append(msec, r);
+            if (now - lastSync >= SYNC_INTERVAL_SECONDS * 1000)
+            {
+                log.Sync();
+                lastSync = now;
+            }
+        });
+        std::signal(SIGINT, OnSignal);
+        std::signal(SIGTERM, OnSignal);
+        meter.Run([]() { return Stop != 0; });
+        log.Sync();
+        if (!meter.IsOpen())
+        {
+            std::fprintf(stderr, "nvlog: %s closed\n", device);
+            return 1;
+        }
+        return 0;
+    }
+
+    int PrintSummary(int argc, char **argv)
+    {
+        int64_t from, to;
+        if (argc != 3 || !ParseTime(argv[1], from) || !ParseTime(argv[2], to))
+        {
+            Usage();
+            return 2;
+        }
+        TelemetryLog log(argv[0], false);
+        TelemetryLog::Rollup r = log.Summarize(from, to);
+        if (r.count == 0)
+        {
+            std::printf("no records\n");
+            return 0;
+        }
+        PrintRollup(r);
+        std::printf("through %s\n", TimeText(r.endMsec));
+        return 0;
+    }
+
+    int PrintSeries(int argc, char **argv)
+    {
+        int64_t from, to;
+        if (argc != 4 || !ParseTime(argv[2], from) || !ParseTime(argv[3], to))
+        {
+            Usage();
+            return 2;
+        }
+        TelemetryLog log(argv[0], false);
+        const char *tier = argv[1];
+        if (std::strcmp(tier, "raw") == 0)
+        {
+            log.ForEach(from, to, [](const TelemetryLog::Entry &e)
+            {
+                std::printf("%s Pf %.1f W Pr %.1f W SWR %s%s\n", TimeText(e.msec),
+                    Watts(e.Pf), Watts(e.Pr), SwrText(e.swr), e.locked ? " LOCK" : "");
+            });
+            return 0;
+        }
+        static const char * const names[TelemetryLog::NUM_TIERS] = { "1s", "1m", "1h" };
+        for (int t = 0; t < TelemetryLog::NUM_TIERS; t++)
+        {
+            if (std::strcmp(tier, names[t]) == 0)
+            {
+                log.ForEachRollup(static_cast<TelemetryLog::Tier>(t), from, to, PrintRollup);
+                return 0;
+            }
+        }
+        Usage();
+        return 2;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        Usage();
+        return 2;
+    }
+    try {
+        if (std::strcmp(argv[1], "record") == 0)
+            return RecordMeter(argc - 2, argv + 2);
+        if (std::strcmp(argv[1], "summary") == 0)
+            return PrintSummary(argc - 2, argv + 2);
+        if (std::strcmp(argv[1], "series") == 0)
+            return PrintSeries(argc - 2, argv + 2);
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "nvlog: %s\n", e.what());
+        return 1;
+    }
+    Usage();
+    return 2;
+}
@@ -0,0 +1,125 @@
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <utility>
+#include <vector>
+#include "MeterClient.h"
+
+/* nvmeter
+** Command line monitor for the PowerMeter sketch's serial port.
+** usage: nvmeter [-p] [-t] [-s x=n ...] <device>
+**      -p  peak power instead of average
+**      -t  also print non-record lines from the meter (banner, command responses)
+**      -s  also subscribe to stream x, every n'th 100 msec. See MeterProtocol.h
+** Prints one line per record received. Subscription lines are printed as received. */
+
+namespace {
+    volatile sig_atomic_t Stop;
+    void OnSignal(int) { Stop = 1; }
+
+    void Usage()
+    {
+        std::fprintf(stderr, "usage: nvmeter [-p] [-t] [-s x=n ...] <device>\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    using namespace NyeViking;
+    Meter::Output output = Meter::Output::AVERAGE;
+    bool text = false;
+    std::vector<std::pair<Stream, unsigned>> subscriptions;
+    const char *device = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "-p") == 0)
+            output = Meter::Output::PEAK;
+        else if (std::strcmp(argv[i], "-t") == 0)
+            text = true;
+        else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+        {
+            Stream s;
+            unsigned n;
+            if (!ParseSubscription(argv[++i], s, n))
+            {
+                Usage();
+                return 2;
+            }
+            subscriptions.emplace_back(s, n);
+        }
+        else if (argv[i][0] != '-' && device == nullptr)
+            device = argv[i];
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+    if (device == nullptr)
+    {
+        Usage();
+        return 2;
+    }
+
+    std::signal(SIGINT, OnSignal);
+    std::signal(SIGTERM, OnSignal);
+    try {
+        Meter meter(device, output);
+        for (const auto &s : subscriptions)
+            meter.Subscribe(s.first, s.second);
+        meter.SetRecordHandler([](const Record &r)
+        {
+            if (!r.Has(Record::LEGACY))
+            {
+                char buf[160];
+                FormatRecord(r, buf, sizeof(buf));
+                std::printf("%s\n", buf);
+                std::fflush(stdout);
+                return;
+            }
+            double swr = r.Swr();
+            char swrText[16];
+            if (std::isnan(swr))
+                std::snprintf(swrText, sizeof(swrText), "-");
+            else if (std::isinf(swr))
+                std::snprintf(swrText, sizeof(swrText), "infinite");
+            else
+                std::snprintf(swrText, sizeof(swrText), "%.2f", swr);
+            char meterText[24] = "";
+            double meter = r.MeterSwr();
+            if (std::isinf(meter))
+                std::snprintf(meterText, sizeof(meterText), "  meter infinite");
+            else if (!std::isnan(meter))
+                std::snprintf(meterText, sizeof(meterText), "  meter %.2f", meter);
+            std::printf("SWR %-8s Pf %8.1f W  Pr %7.1f W%s%s\n",
+                swrText, r.ForwardWatts(), r.ReflectedWatts(), meterText, r.locked ? "  LOCK" : "");
+            std::fflush(stdout);
+        });
+        if (text)
+            meter.SetTextHandler([](const char *p, size_t n)
+            {
+                std::printf("# %.*s\n", static_cast<int>(n), p);
+                std::fflush(stdout);
+            });
+        meter.Run([]() { return Stop != 0; });
+        if (!meter.IsOpen())
+        {
+            std::fprintf(stderr, "nvmeter: %s closed\n", device);
+            return 1;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "nvmeter: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,190 @@
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <vector>
+#include "MeterClient.h"
+
+/* nvrec
+** Downloads the PowerMeter sketch's flight recorder. See namespace recorder in the sketch.
+** usage: nvrec [-t] <device> <file>
+**      -t  also list the trip summaries in the sketch's EEPROM
+** Sends "RECGET" and writes the binary frame that comes back to file, once its Fletcher-16
+** checks. PowerMeterHost's pmreplay plays the file back through the sketch. */
+
+namespace {
+    volatile sig_atomic_t Stop;
+    void OnSignal(int) { Stop = 1; }
+
+    void Usage()
+    {
+        std::fprintf(stderr, "usage: nvrec [-t] <device> <file>\n");
+    }
+
+    typedef NyeViking::Meter::Clock_t Clock_t;
+    const int BootMsec = 3000; // opening the port may reset the sketch. setup() ends with SWRMODE=
+    const int AnswerMsec = 2000; // the frame is about 100 msec at 38400 baud
+
+    // the last two bytes are the Fletcher-16 of the rest, low byte first
+    bool CheckFletcher16(const uint8_t *p, size_t n)
+    {
+        if (n < 2)
+            return false;
+        unsigned sum1 = 0;
+        unsigned sum2 = 0;
+        for (size_t i = 0; i < n - 2; i++)
+        {
+            sum1 = (sum1 + p[i]) % 255;
+            sum2 = (sum2 + sum1) % 255;
+        }
+        return p[n - 2] == sum1 && p[n - 1] == sum2;
+    }
+
+    class Session
+    {
+    public:
+        Session(NyeViking::Meter &meter, bool trips)
+            : m_meter(meter), m_trips(trips), m_state(BOOTING),
+            m_deadline(Clock_t::now() + std::chrono::milliseconds(BootMsec))
+        {
+            m_meter.SetTextHandler([this](const char *p, size_t n) { OnText(p, n); });
+            m_meter.SetBinaryHandler([this](const uint8_t *p, size_t n) { OnBinary(p, n); });
+        }
+
+        bool Done() const { return m_state == DONE; }
+        const std::vector<uint8_t> &Frame() const { return m_frame; }
+
+        void Check(Clock_t::time_point now)
+        {
+            if (m_state == DONE || now < m_deadline)
+                return;
+            if (m_state == BOOTING)
+                Begin();
+            else
+            {
+                std::fprintf(stderr, "nvrec: no answer from %s\n", m_meter.Device().c_str());
+                m_state = DONE;
+            }
+        }
+
+    protected:
+        enum State { BOOTING, LISTING, FETCHING, DONE };
+
+        void Begin()
+        {
+            if (m_trips)
+                Send("TRIPS", LISTING);
+            else
+                Send("RECGET", FETCHING);
+        }
+
+        void Send(const char *c, State s)
+        {
+            m_meter.Command(c);
+            m_state = s;
+            m_deadline = Clock_t::now() + std::chrono::milliseconds(AnswerMsec);
+        }
+
+        void OnText(const char *p, size_t n)
+        {
+            if (m_state == BOOTING)
+            {
+                if (n >= 8 && std::strncmp(p, "SWRMODE=", 8) == 0)
+                    Begin();
+            }
+            else if (m_state == LISTING)
+            {
+                if (n >= 5 && std::strncmp(p, "TRIP", 4) == 0)
+                    std::printf("%.*s\n", static_cast<int>(n), p);
+                if (n >= 6 && std::strncmp(p, "TRIPS=", 6) == 0)
+                    Send("RECGET", FETCHING); // the last line of the list
+            }
+        }
+
+        void OnBinary(const uint8_t *p, size_t n)
+        {
+            if (m_state != FETCHING)
+                return;
+            if (CheckFletcher16(p, n))
+                m_frame.assign(p, p + n);
+            else
+                std::fprintf(stderr, "nvrec: the frame from %s doesn't check\n", m_meter.Device().c_str());
+            m_state = DONE;
+        }
+
+        NyeViking::Meter &m_meter;
+        bool m_trips;
+        State m_state;
+        Clock_t::time_point m_deadline;
+        std::vector<uint8_t> m_frame;
+    };
+}
+
+int main(int argc, char **argv)
+{
+    using namespace NyeViking;
+    bool trips = false;
+    const char *device = nullptr;
+    const char *file = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "-t") == 0)
+            trips = true;
+        else if (argv[i][0] != '-' && device == nullptr)
+            device = argv[i];
+        else if (argv[i][0] != '-' && file == nullptr)
+            file = argv[i];
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+    if (file == nullptr)
+    {
+        Usage();
+        return 2;
+    }
+
+    std::signal(SIGINT, OnSignal);
+    std::signal(SIGTERM, OnSignal);
+    try {
+        Meter meter(device, Meter::Output::NONE);
+        Session session(meter, trips);
+        meter.Run([&session]()
+        {
+            session.Check(Clock_t::now());
+            return Stop || session.Done();
+        });
+        if (session.Frame().empty())
+            return 1;
+        FILE *f = std::fopen(file, "wb");
+        if (f == nullptr)
+        {
+            std::perror(file);
+            return 1;
+        }
+        bool ok = std::fwrite(session.Frame().data(), 1, session.Frame().size(), f) == session.Frame().size();
+        ok = std::fclose(f) == 0 && ok;
+        if (!ok)
+        {
+            std::perror(file);
+            return 1;
+        }
+        std::printf("%zu bytes to %s\n", session.Frame().size(), file);
+        return 0;
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "nvrec: %s\n", e.what());
+        return 1;
+    }
+}
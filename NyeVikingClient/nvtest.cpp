@@ -0,0 +1,996 @@
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include "Aggregator.h"
+#include "Calibration.h"
+#include "MeterClient.h"
+#include "TelemetryLog.h"
+
+/* nvtest
+** Tests of the library against fake sketches on pseudo terminals, and of the Aggregator
+** with clients on its socket, of ClockSync, TelemetryLog and the calibration fit, and of nvcal, which it runs from the
+** current directory. No hardware.
+** usage: nvtest
+** Prints each failed check, and exits 1 if there were any. "make check" runs it. */
+
+namespace {
+    typedef NyeViking::Meter::Clock_t Clock_t;
+    const int WaitMsec = 500; // for bytes to cross the pty
+
+    int Checks;
+    int Failures;
+
+#define CHECK(x) Check((x), #x, __FILE__, __LINE__)
+    void Check(bool ok, const char *what, const char *file, int line)
+    {
+        Checks += 1;
+        if (ok)
+            return;
+        Failures += 1;
+        std::fprintf(stderr, "%s:%d: failed: %s\n", file, line, what);
+    }
+
+    const char RECORD[] = "Vf:1234 Vr:56 Pf:12800 Pr:25 Sw:165 L";
+
+    /* FakeSketch
+    ** The master side of a pty, and a symlink to its slave that stays put when Open()
+    ** makes a new pty, the way a udev name follows a USB serial adapter. */
+    class FakeSketch
+    {
+    public:
+        FakeSketch() : m_master(-1), m_slave(-1)
+        {
+            char dir[] = "/tmp/nvtestXXXXXX";
+            if (::mkdtemp(dir) == nullptr)
+                throw std::system_error(errno, std::generic_category(), "mkdtemp");
+            m_dir = dir;
+            m_path = m_dir + "/ttyNV0";
+            Open();
+        }
+        ~FakeSketch()
+        {
+            Hangup();
+            ::unlink(m_path.c_str());
+            ::rmdir(m_dir.c_str());
+        }
+        FakeSketch(const FakeSketch &) = delete;
+        FakeSketch &operator = (const FakeSketch &) = delete;
+
+        const std::string &Path() const { return m_path; }
+
+        void Open()
+        {
+            Hangup();
+            if (::openpty(&m_master, &m_slave, nullptr, nullptr, nullptr) != 0)
+                throw std::system_error(errno, std::generic_category(), "openpty");
+            ::fcntl(m_master, F_SETFL, ::fcntl(m_master, F_GETFL) | O_NONBLOCK);
+            ::unlink(m_path.c_str());
+            if (::symlink(::ttyname(m_slave), m_path.c_str()) != 0)
+                throw std::system_error(errno, std::generic_category(), m_path);
+            m_input.clear();
+        }
+
+        // the USB adapter is unplugged
+        void Hangup()
+        {
+            if (m_master >= 0)
+                ::close(m_master);
+            if (m_slave >= 0)
+                ::close(m_slave);
+            m_master = m_slave = -1;
+        }
+
+        void Write(const std::string &s)
+        {
+            size_t sent = 0;
+            while (sent < s.size())
+            {
+                ssize_t n = ::write(m_master, s.data() + sent, s.size() - sent);
+                if (n < 0)
+                    throw std::system_error(errno, std::generic_category(), "pty write");
+                sent += n;
+            }
+        }
+        void WriteLine(const std::string &s) { Write(s + "\r\n"); } // as Serial.println
+
+        // the command lines that arrive within msec
+        std::vector<std::string> Lines(int msec = WaitMsec)
+        {
+            std::vector<std::string> lines;
+            Clock_t::time_point end = Clock_t::now() + std::chrono::milliseconds(msec);
+            for (;;)
+            {
+                char buf[256];
+                ssize_t n;
+                while ((n = ::read(m_master, buf, sizeof(buf))) > 0)
+                    m_input.append(buf, n);
+                size_t nl;
+                while ((nl = m_input.find('\n')) != std::string::npos)
+                {
+                    lines.push_back(m_input.substr(0, nl));
+                    m_input.erase(0, nl + 1);
+                }
+                Clock_t::time_point now = Clock_t::now();
+                if (!lines.empty() || now >= end)
+                    break;
+                struct pollfd pfd = { m_master, POLLIN, 0 };
+                ::poll(&pfd, 1, static_cast<int>(
+                    std::chrono::duration_cast<std::chrono::milliseconds>(end - now).count()) + 1);
+            }
+            return lines;
+        }
+
+        bool Received(const char *line, int msec = WaitMsec)
+        {
+            Clock_t::time_point end = Clock_t::now() + std::chrono::milliseconds(msec);
+            do
+            {
+                for (const auto &l : Lines(msec))
+                    if (l == line)
+                        return true;
+            } while (Clock_t::now() < end);
+            return false;
+        }
+
+    protected:
+        int m_master;
+        int m_slave; // held so the master doesn't see a hangup before the Meter opens it
+        std::string m_dir;
+        std::string m_path;
+        std::string m_input;
+    };
+
+    /* FeedClient
+    ** A client of an Aggregator's socket. */
+    class FeedClient
+    {
+    public:
+        explicit FeedClient(const std::string &path) : m_fd(-1)
+        {
+            struct sockaddr_un addr;
+            std::memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+            m_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (m_fd < 0 || ::connect(m_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0)
+                throw std::system_error(errno, std::generic_category(), path);
+            ::fcntl(m_fd, F_SETFL, ::fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+        }
+        ~FeedClient() { Close(); }
+        FeedClient(const FeedClient &) = delete;
+        FeedClient &operator = (const FeedClient &) = delete;
+
+        void Close()
+        {
+            if (m_fd >= 0)
+                ::close(m_fd);
+            m_fd = -1;
+        }
+
+        // reads what has arrived. false once the aggregator has closed the connection
+        bool Read()
+        {
+            char buf[4096];
+            for (;;)
+            {
+                ssize_t n = ::read(m_fd, buf, sizeof(buf));
+                if (n > 0)
+                {
+                    m_input.append(buf, n);
+                    continue;
+                }
+                if (n == 0 || (errno != EAGAIN && errno != EINTR))
+                    return false;
+                break;
+            }
+            size_t nl;
+            while ((nl = m_input.find('\n')) != std::string::npos)
+            {
+                m_lines.push_back(m_input.substr(0, nl));
+                m_input.erase(0, nl + 1);
+            }
+            return true;
+        }
+
+        // lines read so far that contain s, which are then forgotten
+        unsigned Count(const char *s)
+        {
+            unsigned n = 0;
+            for (auto i = m_lines.begin(); i != m_lines.end(); )
+            {
+                if (i->find(s) != std::string::npos)
+                {
+                    n += 1;
+                    i = m_lines.erase(i);
+                }
+                else
+                    ++i;
+            }
+            return n;
+        }
+
+    protected:
+        int m_fd;
+        std::string m_input;
+        std::vector<std::string> m_lines;
+    };
+
+    // Service(now) once what the fake wrote has arrived
+    bool Pump(NyeViking::Meter &meter, Clock_t::time_point now)
+    {
+        struct pollfd pfd = { meter.Fd(), POLLIN, 0 };
+        ::poll(&pfd, 1, WaitMsec);
+        return meter.Service(now);
+    }
+
+    void TestParserSplit()
+    {
+        const std::string line = std::string(RECORD) + "\r\n";
+        for (size_t split = 0; split <= line.size(); split++)
+        {
+            NyeViking::RecordParser parser;
+            unsigned records = 0, texts = 0;
+            uint32_t Pf = 0;
+            bool locked = false;
+            parser.SetRecordHandler([&](const NyeViking::Record &r) { records += 1; Pf = r.Pf; locked = r.locked; });
+            parser.SetTextHandler([&](const char *, size_t) { texts += 1; });
+            parser.Feed(line.data(), split);
+            parser.Feed(line.data() + split, line.size() - split);
+            CHECK(records == 1 && texts == 0 && Pf == 12800 && locked);
+        }
+
+        NyeViking::RecordParser parser;
+        unsigned records = 0;
+        parser.SetRecordHandler([&](const NyeViking::Record &) { records += 1; });
+        const std::string three = line + "BOOT\r\n" + line + line;
+        for (char c : three)
+            parser.Feed(&c, 1);
+        CHECK(records == 3);
+        CHECK(parser.RecordCount() == 3 && parser.ErrorCount() == 0);
+    }
+
+    void TestParserOverlong()
+    {
+        const size_t MaxLine = 128; // RecordParser::MAX_LINE
+        NyeViking::RecordParser parser;
+        unsigned records = 0;
+        std::vector<size_t> texts;
+        parser.SetRecordHandler([&](const NyeViking::Record &) { records += 1; });
+        parser.SetTextHandler([&](const char *, size_t n) { texts.push_back(n); });
+
+        std::string longest(MaxLine, 'x');
+        parser.Feed(longest.data(), longest.size());
+        parser.Feed("\r\n", 2);
+        CHECK(texts.size() == 1 && texts[0] == MaxLine);
+
+        // a record at the end of a line too long to keep is dropped with it
+        std::string tooLong = std::string(MaxLine - 10, 'x') + " " + RECORD;
+        parser.Feed(tooLong.data(), 50);
+        parser.Feed(tooLong.data() + 50, tooLong.size() - 50);
+        parser.Feed("\n", 1);
+        CHECK(records == 0 && texts.size() == 1);
+        CHECK(parser.ErrorCount() == 1);
+
+        // and the next line is whole
+        const std::string line = std::string(RECORD) + "\r\n";
+        parser.Feed(line.data(), line.size());
+        CHECK(records == 1 && texts.size() == 1);
+    }
+
+    void TestKeepAlive()
+    {
+        using std::chrono::milliseconds;
+        FakeSketch sketch;
+        NyeViking::Meter meter(sketch.Path());
+        unsigned records = 0;
+        meter.SetRecordHandler([&](const NyeViking::Record &) { records += 1; });
+        CHECK(sketch.Received("P ON"));
+        meter.Subscribe(NyeViking::Stream::SWR, 5);
+        CHECK(sketch.Received("SUB S=5"));
+
+        // nothing yet. The boot loader may have eaten the request, so it is repeated
+        Clock_t::time_point t0 = Clock_t::now();
+        CHECK(meter.Service(t0));
+        CHECK(sketch.Lines(50).empty());
+        CHECK(meter.PollMsec(t0) <= static_cast<int>(NyeViking::Meter::InitialRequestMsec) + 1);
+        Clock_t::time_point t1 = t0 + milliseconds(NyeViking::Meter::InitialRequestMsec + 10);
+        CHECK(meter.Service(t1));
+        std::vector<std::string> lines = sketch.Lines();
+        for (const auto &l : sketch.Lines(100))
+            lines.push_back(l);
+        bool on = false, sub = false;
+        for (const auto &l : lines)
+        {
+            on = on || l == "P ON";
+            sub = sub || l == "SUB S=5";
+        }
+        CHECK(on && sub); // the subscriptions go with it
+
+        // once records come, only before the sketch's output times out
+        sketch.WriteLine(RECORD);
+        CHECK(Pump(meter, t1));
+        CHECK(records == 1);
+        Clock_t::time_point t2 = Clock_t::now();
+        CHECK(meter.Service(t2 + milliseconds(NyeViking::Meter::InitialRequestMsec + 10)));
+        CHECK(sketch.Lines(100).empty());
+        CHECK(meter.PollMsec(t2) > static_cast<int>(NyeViking::KeepAliveMsec) / 2);
+        CHECK(meter.Service(t2 + milliseconds(NyeViking::KeepAliveMsec + 10)));
+        CHECK(sketch.Received("P ON"));
+    }
+
+    /* The sketch's Comm::Subscribe and its 100 msec comm update, for streams A and H */
+    class FakeSubscriptions
+    {
+    public:
+        FakeSubscriptions() : m_decimation(), m_countdown() {}
+
+        void Command(const std::string &line)
+        {
+            const char *p = std::strchr("AH", line.size() > 6 ? line[4] : 0);
+            if (line.compare(0, 4, "SUB ") != 0 || p == nullptr || *p == 0 || line[5] != '=')
+                return;
+            int i = p - "AH";
+            unsigned d = static_cast<unsigned>(std::atoi(line.c_str() + 6));
+            if (m_decimation[i] == d)
+                return;
+            m_decimation[i] = d;
+            m_countdown[i] = 1;
+        }
+
+        // the line the update sends, if any
+        std::string Update(uint32_t tm)
+        {
+            std::string line;
+            static const char * const fields[2] = { "Fa:12800 Ra:25 ", "Fh:25600 Rh:51 " };
+            for (int i = 0; i < 2; i++)
+                if (m_decimation[i] != 0 && --m_countdown[i] == 0)
+                {
+                    m_countdown[i] = m_decimation[i];
+                    line += fields[i];
+                }
+            if (!line.empty())
+                line += "Tm:" + std::to_string(tm);
+            return line;
+        }
+
+    protected:
+        unsigned m_decimation[2];
+        unsigned m_countdown[2];
+    };
+
+    void TestKeepAliveKeepsPhase()
+    {
+        using std::chrono::milliseconds;
+        FakeSketch sketch;
+        FakeSubscriptions subs;
+        NyeViking::Meter meter(sketch.Path(), NyeViking::Meter::Output::NONE);
+        unsigned average = 0, hold = 0;
+        meter.SetRecordHandler([&](const NyeViking::Record &r)
+        {
+            average += r.Has(NyeViking::Record::FA);
+            hold += r.Has(NyeViking::Record::FH);
+        });
+        meter.Subscribe(NyeViking::Stream::AVERAGE, 3);
+        meter.Subscribe(NyeViking::Stream::HOLD, 100); // every 10 seconds, longer than a keep alive
+
+        // 25 seconds of 100 msec updates, on the sketch's clock
+        const int Updates = 250;
+        unsigned keepAlives = 0;
+        Clock_t::time_point t0 = Clock_t::now();
+        for (int u = 0; u <= Updates; u++)
+        {
+            Clock_t::time_point now = t0 + milliseconds(100 * u);
+            for (const auto &l : sketch.Lines(5))
+            {
+                keepAlives += l == "SUB H=100";
+                subs.Command(l);
+            }
+            std::string line = u == 0 ? std::string() : subs.Update(100000u * u);
+            if (line.empty())
+                CHECK(meter.Service(now));
+            else
+            {
+                sketch.WriteLine(line);
+                CHECK(Pump(meter, now));
+            }
+        }
+        CHECK(keepAlives >= Updates / 10 / (NyeViking::KeepAliveMsec / 1000)); // and the first
+        CHECK(average == (Updates + 2) / 3); // updates 1, 4, 7...
+        CHECK(hold == 3); // updates 1, 101 and 201, whatever the keep alives
+    }
+
+    void TestReopen()
+    {
+        FakeSketch sketch;
+        {
+            NyeViking::Meter meter(sketch.Path());
+            unsigned records = 0;
+            meter.SetRecordHandler([&](const NyeViking::Record &) { records += 1; });
+            CHECK(sketch.Received("P ON"));
+            sketch.WriteLine(RECORD);
+            CHECK(Pump(meter, Clock_t::now()));
+            CHECK(records == 1);
+
+            sketch.Hangup();
+            Clock_t::time_point giveUp = Clock_t::now() + std::chrono::seconds(2);
+            meter.Run([giveUp]() { return Clock_t::now() > giveUp; });
+            CHECK(!meter.IsOpen());
+            CHECK(!meter.Service());
+        }
+
+        // nothing behind the name until the adapter is back
+        bool threw = false;
+        try {
+            NyeViking::Meter meter(sketch.Path());
+        }
+        catch (const std::system_error &)
+        {
+            threw = true;
+        }
+        CHECK(threw);
+
+        sketch.Open();
+        NyeViking::Meter meter(sketch.Path());
+        unsigned records = 0;
+        meter.SetRecordHandler([&](const NyeViking::Record &) { records += 1; });
+        CHECK(meter.IsOpen());
+        CHECK(sketch.Received("P ON"));
+        sketch.WriteLine(RECORD);
+        CHECK(Pump(meter, Clock_t::now()));
+        CHECK(records == 1);
+    }
+
+    // RunOnce() until done() or msec
+    template <typename F>
+    bool RunUntil(NyeViking::Aggregator &agg, FeedClient &client, int msec, F done)
+    {
+        Clock_t::time_point end = Clock_t::now() + std::chrono::milliseconds(msec);
+        while (Clock_t::now() < end)
+        {
+            agg.RunOnce(20);
+            client.Read();
+            if (done())
+                return true;
+        }
+        return false;
+    }
+
+    void TestAggregator()
+    {
+        FakeSketch a, b;
+        char dir[] = "/tmp/nvtestXXXXXX";
+        if (::mkdtemp(dir) == nullptr)
+            throw std::system_error(errno, std::generic_category(), "mkdtemp");
+        const std::string socketPath = std::string(dir) + "/nvaggd.sock";
+        {
+            NyeViking::Aggregator agg;
+            agg.Listen(socketPath);
+            agg.AddStation("a", a.Path());
+            agg.AddStation("b", b.Path());
+            FeedClient reader(socketPath);
+            FeedClient slow(socketPath); // never reads
+            FeedClient leaving(socketPath);
+            agg.RunOnce(0);
+            CHECK(a.Received("P ON") && b.Received("P ON"));
+            CHECK(RunUntil(agg, reader, 1000, [&]() { return agg.ClientCount() == 3; }));
+
+            // fan in: both stations' records go to every client, each line marked with its station
+            a.WriteLine(RECORD);
+            b.WriteLine(RECORD);
+            unsigned fromA = 0, fromB = 0;
+            CHECK(RunUntil(agg, reader, 1000, [&]()
+            {
+                fromA += reader.Count(" a Vf:1234 Vr:56 Pf:12800 Pr:25 Sw:165 L");
+                fromB += reader.Count(" b Vf:1234 Vr:56 Pf:12800 Pr:25 Sw:165 L");
+                return fromA == 1 && fromB == 1;
+            }));
+            leaving.Read();
+            CHECK(leaving.Count(" a Vf:") == 1 && leaving.Count(" b Vf:") == 1);
+
+            // a client that goes away with records on their way to it, and one that stops
+            // reading, are dropped. No SIGPIPE, and the others carry on
+            const int Burst = 40; // of records, within the pty's buffer
+            std::string burst;
+            for (int i = 0; i < Burst; i++)
+                burst += std::string(RECORD) + "\r\n";
+            a.Write(burst);
+            agg.RunOnce(20);
+            leaving.Close();
+            fromA = 0;
+            for (int i = 0; i < 2000 && agg.ClientCount() > 1; i++)
+            {
+                a.Write(burst);
+                b.Write(burst);
+                for (int j = 0; j < 4; j++)
+                    agg.RunOnce(5);
+                reader.Read();
+                fromA += reader.Count(" a Vf:");
+            }
+            CHECK(agg.ClientCount() == 1);
+            CHECK(!slow.Read());
+            CHECK(RunUntil(agg, reader, 1000, [&]()
+            {
+                fromA += reader.Count(" a Vf:");
+                return fromA > static_cast<unsigned>(Burst) && reader.Count(" b Vf:") > 0;
+            }));
+
+            // a meter that goes away is reopened once it is back, and b carries on meanwhile
+            a.Hangup();
+            CHECK(RunUntil(agg, reader, 2000, [&]() { return reader.Count(" a # closed") == 1; }));
+            CHECK(agg.StationCount() == 2);
+            b.WriteLine(RECORD);
+            CHECK(RunUntil(agg, reader, 1000, [&]() { return reader.Count(" b Vf:") > 0; }));
+            a.Open();
+            CHECK(RunUntil(agg, reader, NyeViking::Aggregator::ReopenMsec + 2000,
+                [&]() { return reader.Count(" a # open") == 1; }));
+            CHECK(a.Received("P ON"));
+            a.WriteLine(RECORD);
+            CHECK(RunUntil(agg, reader, 1000, [&]() { return reader.Count(" a Vf:") == 1; }));
+        }
+        CHECK(::access(socketPath.c_str(), F_OK) != 0); // removed with the Aggregator
+        ::rmdir(dir);
+    }
+
+    // a point the sketch would capture at measured volts x, for a coupler whose true volts are
+    // the fit g/32768 x + o + c/2**30 x**2. The uncalibrated power shown is square / 256
+    NyeViking::CalibrationPoint MakePoint(unsigned n, bool reflected, double x, double g, double o, double c)
+    {
+        NyeViking::CalibrationPoint p;
+        p.n = n;
+        p.reflected = reflected;
+        p.square = static_cast<uint32_t>(x * x);
+        p.nominal = p.square / 256;
+        double t = g / 32768 * x + o + c / 1073741824.0 * x * x;
+        p.watts = static_cast<uint32_t>(std::lround(p.nominal * (t * t) / (x * x)));
+        return p;
+    }
+
+    bool Near(long a, long b, long tolerance) { return a >= b - tolerance && a <= b + tolerance; }
+
+    void TestCalibrationFit()
+    {
+        const double X[] = { 2000, 5000, 10000, 20000, 40000 };
+        NyeViking::CalibrationFit fit;
+
+        // three terms, forward, from five points. A reflected point is not fit with them
+        std::vector<NyeViking::CalibrationPoint> points;
+        for (unsigned i = 0; i < 5; i++)
+            points.push_back(MakePoint(i, false, X[i], 36000, -120, 50));
+        points.push_back(MakePoint(5, true, 8000, 30000, 0, 0));
+        CHECK(NyeViking::FitCalibration(points, false, fit));
+        CHECK(!fit.reflected && fit.terms == 3);
+        CHECK(Near(fit.gain, 36000, 2) && Near(fit.offset, -120, 2) && Near(fit.curve, 50, 2));
+        // and the sketch's fixed point shows the reference power with it
+        for (unsigned i = 0; i < 5; i++)
+        {
+            double reference = static_cast<double>(points[i].watts) / NyeViking::WattsToDisplay;
+            CHECK(std::fabs(NyeViking::CalibratedWatts(fit, points[i]) - reference) < reference * 0.002);
+        }
+
+        // one point is gain alone, two add the offset
+        CHECK(NyeViking::FitCalibration(points, true, fit));
+        CHECK(fit.reflected && fit.terms == 1 && Near(fit.gain, 30000, 1) && fit.offset == 0 && fit.curve == 0);
+        double reference = static_cast<double>(points[5].watts) / NyeViking::WattsToDisplay;
+        CHECK(std::fabs(NyeViking::CalibratedWatts(fit, points[5]) - reference) < reference * 0.001);
+        points.clear();
+        points.push_back(MakePoint(0, false, 3000, 49104, 300, 0));
+        points.push_back(MakePoint(1, false, 30000, 49104, 300, 0));
+        CHECK(NyeViking::FitCalibration(points, false, fit));
+        CHECK(fit.terms == 2 && Near(fit.gain, 49104, 2) && Near(fit.offset, 300, 2) && fit.curve == 0);
+
+        // none, or what the sketch's 16 bits can't hold
+        CHECK(!NyeViking::FitCalibration(points, true, fit));
+        struct { double g, o, c; } const outOfRange[] = {
+            { 70000, 0, 0 }, { 0x8000, 40000, 0 }, { 0x8000, -40000, 0 }, { 0x8000, 0, 40000 }, { 0x8000, 0, -40000 },
+        };
+        for (const auto &r : outOfRange)
+        {
+            points.clear();
+            for (unsigned i = 0; i < 5; i++)
+                points.push_back(MakePoint(i, false, X[i], r.g, r.o, r.c));
+            CHECK(!NyeViking::FitCalibration(points, false, fit));
+        }
+
+        fit.reflected = true;
+        fit.gain = 32848;
+        fit.offset = -607;
+        fit.curve = 3;
+        auto commands = NyeViking::FitCommands(fit);
+        CHECK(commands.size() == 3 && commands[0] == "CALG R=32848" && commands[1] == "CALO R=-607" &&
+            commands[2] == "CALC R=3");
+    }
+
+    void TestCalibrationParse()
+    {
+        NyeViking::CalibrationPoint p;
+        const char point[] = "CAL 2 W:1600 F:41830912 N:1491";
+        CHECK(NyeViking::ParseCalibrationPoint(point, sizeof(point) - 1, p));
+        CHECK(p.n == 2 && !p.reflected && p.watts == 1600 && p.square == 41830912 && p.nominal == 1491);
+        const char reflected[] = "CAL 7 W:128 R:1000 N:120";
+        CHECK(NyeViking::ParseCalibrationPoint(reflected, sizeof(reflected) - 1, p) && p.reflected && p.n == 7);
+        const char badDirection[] = "CAL 2 W:1600 X:41830912 N:1491";
+        CHECK(!NyeViking::ParseCalibrationPoint(badDirection, sizeof(badDirection) - 1, p));
+        const char noRf[] = "CAL 3 no RF";
+        CHECK(!NyeViking::ParseCalibrationPoint(noRf, sizeof(noRf) - 1, p));
+
+        NyeViking::CalibrationFit f;
+        const char fit[] = "CALR G:32848 O:-607 C:3";
+        CHECK(NyeViking::ParseCalibrationFit(fit, sizeof(fit) - 1, f));
+        CHECK(f.reflected && f.gain == 32848 && f.offset == -607 && f.curve == 3 && f.terms == 3);
+        const char gainOnly[] = "CALF G:30000 O:0 C:0";
+        CHECK(NyeViking::ParseCalibrationFit(gainOnly, sizeof(gainOnly) - 1, f) && !f.reflected && f.terms == 1);
+        const char badFit[] = "CALX G:1 O:0 C:0";
+        CHECK(!NyeViking::ParseCalibrationFit(badFit, sizeof(badFit) - 1, f));
+        CHECK(!NyeViking::ParseCalibrationFit(point, sizeof(point) - 1, f));
+    }
+
+    /* nvcal -l against a fake sketch that lists two forward points, answers each CALG, CALO
+    ** and CALC a while later with the whole listing, and counts commands that arrive before
+    ** it has answered. corrupt stores each curve one more than it was sent.
+    ** Returns nvcal's exit status */
+    int RunNvcal(bool corrupt, unsigned &overlapped)
+    {
+        FakeSketch sketch;
+        pid_t pid = ::fork();
+        if (pid < 0)
+            throw std::system_error(errno, std::generic_category(), "fork");
+        if (pid == 0)
+        {
+            int null = ::open("/dev/null", O_WRONLY);
+            ::dup2(null, 1);
+            ::dup2(null, 2);
+            ::execl("./nvcal", "nvcal", "-l", sketch.Path().c_str(), static_cast<char *>(nullptr));
+            ::_exit(127);
+        }
+        std::vector<NyeViking::CalibrationPoint> points;
+        points.push_back(MakePoint(0, false, 3000, 33000, 200, 0));
+        points.push_back(MakePoint(1, false, 30000, 33000, 200, 0));
+        long fit[2][3] = { { 32768, 0, 0 }, { 32768, 0, 0 } };
+        auto listing = [&]()
+        {
+            std::string s;
+            for (const auto &p : points)
+                s += "CAL " + std::to_string(p.n) + " W:" + std::to_string(p.watts) + " F:" +
+                    std::to_string(p.square) + " N:" + std::to_string(p.nominal) + "\r\n";
+            for (int d = 0; d < 2; d++)
+                s += std::string(d ? "CALR" : "CALF") + " G:" + std::to_string(fit[d][0]) + " O:" +
+                    std::to_string(fit[d][1]) + " C:" + std::to_string(fit[d][2]) + "\r\n";
+            sketch.Write(s);
+        };
+
+        overlapped = 0;
+        bool pending = false;
+        sketch.WriteLine("SWRMODE=PEAK");
+        int status = -1;
+        Clock_t::time_point giveUp = Clock_t::now() + std::chrono::seconds(20);
+        while (Clock_t::now() < giveUp)
+        {
+            std::vector<std::string> lines = sketch.Lines(50); // the answer is late by this much
+            if (lines.empty() && pending)
+            {
+                listing();
+                pending = false;
+            }
+            for (const auto &l : lines)
+            {
+                if (l == "CAL")
+                    listing();
+                else if (l.size() > 7 && l.compare(0, 3, "CAL") == 0 && l[4] == ' ' && l[6] == '=')
+                {
+                    overlapped += pending;
+                    const char *term = std::strchr("GOC", l[3]);
+                    long v = std::atol(l.c_str() + 7);
+                    if (term != nullptr && *term != 0)
+                        fit[l[5] == 'R'][term - "GOC"] = v + (corrupt && *term == 'C');
+                    pending = true;
+                }
+            }
+            if (::waitpid(pid, &status, WNOHANG) == pid)
+                return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        }
+        ::kill(pid, SIGKILL);
+        ::waitpid(pid, &status, 0);
+        return -1;
+    }
+
+    void TestNvcalStore()
+    {
+        unsigned overlapped;
+        CHECK(RunNvcal(false, overlapped) == 0);
+        CHECK(overlapped == 0);
+        CHECK(RunNvcal(true, overlapped) == 1);
+        CHECK(overlapped == 0);
+    }
+
+    /* A sketch whose micros() runs ppm faster than the host clock, from device micros base
+    ** at host time zero, and the PING/PONG exchanges with it, as ClockSync sees them. */
+    struct SyncSim
+    {
+        static const size_t SentBytes = 7; // PING=1 and newline
+        static const size_t ReceivedBytes = 15;
+        NyeViking::ClockSync sync;
+        double ppm;
+        double base;
+        int64_t byteNsec;
+
+        SyncSim(double drift, double deviceBase)
+            : sync(NyeViking::SerialPort::DefaultBaud), ppm(drift), base(deviceBase)
+            , byteNsec(static_cast<int64_t>(10 * 1e9 / NyeViking::SerialPort::DefaultBaud))
+        {}
+
+        uint32_t Micros(int64_t hostNsec) const
+        {
+            double us = base + hostNsec * (1 + ppm * 1e-6) / 1000;
+            return static_cast<uint32_t>(static_cast<uint64_t>(us) & 0xFFFFFFFFu);
+        }
+
+        // the USB latencies only ever delay, on the way out and on the way back
+        void Exchange(int64_t hostSent, int64_t latencyOut, int64_t latencyBack)
+        {
+            int64_t arrived = hostSent + static_cast<int64_t>(SentBytes) * byteNsec + latencyOut;
+            int64_t received = arrived + static_cast<int64_t>(ReceivedBytes) * byteNsec + latencyBack;
+            sync.AddExchange(hostSent, received, Micros(arrived), SentBytes, ReceivedBytes);
+        }
+
+        // how far the fit puts micros() at host time t from t
+        int64_t ErrorNsec(int64_t t) const { return sync.DeviceToHostNsec(Micros(t)) - t; }
+    };
+
+    const int64_t MSEC = 1000000;
+    const int64_t SEC = 1000 * MSEC;
+
+    void TestClockSyncDrift()
+    {
+        // micros() wraps 60 seconds in. Most exchanges are slow one way, which would bias the
+        // fit by several msec. One in five is quick both ways, and those are the ones kept
+        SyncSim sim(250, 4294967296.0 - 60e6);
+        int64_t t = 0;
+        for (int i = 0; i < 150; i++, t += SEC)
+        {
+            if (i % 5 == 0)
+                sim.Exchange(t, MSEC / 2, MSEC / 2);
+            else
+                sim.Exchange(t, 15 * MSEC, MSEC);
+        }
+        CHECK(sim.sync.Valid());
+        CHECK(sim.sync.Count() == NyeViking::ClockSync::Window);
+        CHECK(std::fabs(sim.sync.DriftPpm() - 250) < 5);
+        CHECK(std::llabs(sim.sync.UncertaintyNsec() - MSEC / 2) < MSEC / 100);
+        CHECK(std::llabs(sim.ErrorNsec(t)) < MSEC);
+        CHECK(std::llabs(sim.ErrorNsec(t - 100 * SEC)) < MSEC); // back before the wrap
+
+        // a slow device too
+        SyncSim slow(-400, 1e6);
+        for (int i = 0; i < 60; i++)
+            slow.Exchange(i * SEC, MSEC / 2, MSEC / 2);
+        CHECK(std::fabs(slow.sync.DriftPpm() + 400) < 5);
+        CHECK(std::llabs(slow.ErrorNsec(60 * SEC)) < MSEC);
+    }
+
+    void TestClockSyncJump()
+    {
+        SyncSim sim(100, 5e6);
+        int64_t t = 0;
+        for (int i = 0; i < 20; i++, t += SEC)
+            sim.Exchange(t, MSEC / 2, MSEC / 2);
+        CHECK(sim.sync.Count() == 20);
+
+        // a stalled host makes a slow exchange, but not a jump
+        sim.Exchange(t, 40 * MSEC, 40 * MSEC);
+        t += SEC;
+        CHECK(sim.sync.Count() == 21 && sim.sync.Valid());
+
+        // the sketch resets: micros() starts over from zero, and the fit with it
+        sim.base = -t / 1000.0 * (1 + sim.ppm * 1e-6) + 1.5e6;
+        sim.Exchange(t, MSEC / 2, MSEC / 2);
+        t += SEC;
+        CHECK(sim.sync.Count() == 1 && !sim.sync.Valid());
+        for (int i = 0; i < 5; i++, t += SEC)
+            sim.Exchange(t, MSEC / 2, MSEC / 2);
+        CHECK(sim.sync.Valid() && std::llabs(sim.ErrorNsec(t)) < MSEC);
+
+        // the sketch sleeps for 5 seconds, with micros() stopped
+        sim.base -= 5e6 * (1 + sim.ppm * 1e-6);
+        t += 5 * SEC;
+        sim.Exchange(t, MSEC / 2, MSEC / 2);
+        CHECK(sim.sync.Count() == 1);
+        for (int i = 0; i < 5; i++)
+            sim.Exchange(t += SEC, MSEC / 2, MSEC / 2);
+        CHECK(sim.sync.Valid() && std::llabs(sim.ErrorNsec(t)) < MSEC);
+    }
+
+    bool SameEntry(const NyeViking::TelemetryLog::Entry &a, const NyeViking::TelemetryLog::Entry &b)
+    {
+        return a.msec == b.msec && a.Pf == b.Pf && a.Pr == b.Pr && a.swr == b.swr && a.locked == b.locked;
+    }
+
+    bool SameSummary(const NyeViking::TelemetryLog::Rollup &a, const NyeViking::TelemetryLog::Rollup &b)
+    {
+        if (a.count != b.count)
+            return false;
+        return a.count == 0 || (a.endMsec == b.endMsec && a.lockCount == b.lockCount &&
+            a.swrCount == b.swrCount && a.PfMin == b.PfMin && a.PfMax == b.PfMax &&
+            a.PrMin == b.PrMin && a.PrMax == b.PrMax && a.swrMin == b.swrMin && a.swrMax == b.swrMax &&
+            a.PfSum == b.PfSum && a.PrSum == b.PrSum && a.swrSum == b.swrSum);
+    }
+
+    void TestTelemetryLog()
+    {
+        typedef NyeViking::TelemetryLog Log;
+        char dir[] = "/tmp/nvtestXXXXXX";
+        if (::mkdtemp(dir) == nullptr)
+            throw std::system_error(errno, std::generic_category(), "mkdtemp");
+
+        // 2500 records 100 msec apart with small steps, which fill blocks by count. Then
+        // 2000 over about eight hours, with time and power steps that need escapes
+        std::vector<Log::Entry> entries;
+        uint32_t seed = 12345;
+        auto random = [&seed](uint32_t n) { seed = seed * 1103515245u + 12345u; return (seed >> 8) % n; };
+        Log::Entry e = Log::Entry();
+        e.msec = 1700000000000LL + 1234; // not on any period boundary
+        e.Pf = 12800;
+        e.Pr = 25;
+        for (int i = 0; i < 4500; i++)
+        {
+            if (i < 2500)
+            {
+                e.msec += 100;
+                e.Pf += random(201) - 100;
+                e.Pr = random(50);
+                e.swr = static_cast<uint16_t>(1000 + random(2000));
+            }
+            else
+            {
+                uint32_t r = random(100);
+                e.msec += r < 5 ? 0 : r < 80 ? 100 + random(1900) : 70000 + random(50000);
+                e.Pf = random(4) == 0 ? random(1u << 30) : random(20000);
+                e.Pr = random(4) == 0 ? random(1u << 28) : random(2000);
+                r = random(10);
+                e.swr = r == 0 ? Log::SWR_NONE : r == 1 ? Log::SWR_INFINITE : static_cast<uint16_t>(1000 + random(60000));
+            }
+            e.locked = random(7) == 0;
+            entries.push_back(e);
+        }
+        const int64_t first = entries.front().msec;
+        const int64_t end = entries.back().msec + 1;
+
+        {
+            Log log(dir);
+            for (const auto &x : entries)
+                log.Append(x);
+            CHECK(log.RawCount() == entries.size());
+
+            // every record back as it went in
+            size_t i = 0;
+            bool same = true;
+            log.ForEach(INT64_MIN, INT64_MAX, [&](const Log::Entry &x)
+            {
+                same = same && i < entries.size() && SameEntry(x, entries[i]);
+                i += 1;
+            });
+            CHECK(same && i == entries.size());
+
+            // each tier has one rollup per period with records, in order, matching the records
+            for (int t = 0; t < Log::NUM_TIERS; t++)
+            {
+                const int64_t p = Log::TierMsec[t];
+                size_t next = 0;
+                bool ok = true;
+                log.ForEachRollup(static_cast<Log::Tier>(t), INT64_MIN, INT64_MAX, [&](const Log::Rollup &r)
+                {
+                    Log::Rollup expect = Log::Rollup();
+                    int64_t start = entries[next].msec - entries[next].msec % p;
+                    for (; next < entries.size() && entries[next].msec < start + p; next++)
+                        expect.Add(entries[next]);
+                    ok = ok && r.startMsec == start && SameSummary(r, expect);
+                });
+                CHECK(ok && next == entries.size());
+            }
+            CHECK(log.RollupCount(Log::TIER_HOUR) >= 8);
+
+            // summaries over ranges that split the tiers every which way, against the records
+            std::vector<std::pair<int64_t, int64_t>> ranges = {
+                { INT64_MIN / 2, INT64_MAX / 2 }, { first, end }, { first + 1, end - 1 },
+                { first - first % 3600000 + 3600000, end - end % 3600000 }, // whole hours
+                { first + 250, first + 250 }, // empty
+                { end, end + 3600000 }, // after them all
+            };
+            for (int i = 0; i < 200; i++)
+            {
+                int64_t a = first + static_cast<int64_t>(random(static_cast<uint32_t>(end - first)));
+                int64_t b = first + static_cast<int64_t>(random(static_cast<uint32_t>(end - first)));
+                ranges.emplace_back(std::min(a, b), std::max(a, b));
+            }
+            unsigned mismatches = 0;
+            for (const auto &r : ranges)
+            {
+                Log::Rollup expect = Log::Rollup();
+                for (const auto &x : entries)
+                    if (x.msec >= r.first && x.msec < r.second)
+                        expect.Add(x);
+                mismatches += !SameSummary(log.Summarize(r.first, r.second), expect);
+            }
+            CHECK(mismatches == 0);
+        }
+
+        // a later run whose clock is behind: the record goes in at the log's last time
+        {
+            Log log(dir);
+            e.msec = entries.back().msec - 5000;
+            e.Pf = 777;
+            log.Append(e);
+            e.msec = entries.back().msec + 100;
+            log.Append(e);
+            CHECK(log.RawCount() == entries.size() + 2);
+            std::vector<int64_t> times;
+            log.ForEach(entries.back().msec, INT64_MAX, [&](const Log::Entry &x) { times.push_back(x.msec); });
+            CHECK(times.size() == 3 && times[0] == entries.back().msec && times[1] == entries.back().msec &&
+                times[2] == entries.back().msec + 100);
+            for (int t = 0; t < Log::NUM_TIERS; t++)
+            {
+                bool ordered = true;
+                for (uint64_t i = 1; i < log.RollupCount(static_cast<Log::Tier>(t)); i++)
+                    ordered = ordered && log.GetRollup(static_cast<Log::Tier>(t), i - 1).startMsec <
+                        log.GetRollup(static_cast<Log::Tier>(t), i).startMsec;
+                CHECK(ordered);
+            }
+            CHECK(log.Summarize(first, end + 100).count == entries.size() + 2);
+        }
+
+        // and a reader sees what the writer left
+        {
+            Log log(dir, false);
+            CHECK(log.RawCount() == entries.size() + 2);
+        }
+        for (const char *f : { "/raw.nvl", "/1s.nvl", "/1m.nvl", "/1h.nvl" })
+            ::unlink((std::string(dir) + f).c_str());
+        ::rmdir(dir);
+    }
+}
+
+int main()
+{
+    try {
+        TestParserSplit();
+        TestParserOverlong();
+        TestKeepAlive();
+        TestKeepAliveKeepsPhase();
+        TestReopen();
+        TestAggregator();
+        TestCalibrationFit();
+        TestCalibrationParse();
+        TestNvcalStore();
+        TestClockSyncDrift();
+        TestClockSyncJump();
+        TestTelemetryLog();
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "nvtest: %s\n", e.what());
+        return 1;
+    }
+    std::printf("nvtest: %d checks, %d failed\n", Checks, Failures);
+    return Failures ? 1 : 0;
+}
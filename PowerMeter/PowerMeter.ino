@@ -41,12 +41,23 @@ static_assert(sizeof(uint64_t)==8, "uint64_t");
 
 // Use one of the following two. 
 // Affects the arithmetic calculating power/SWR from the ADCs
+// (A -D on the compiler command line overrides, as Budget/budget.sh does for each configuration.)
+#if !defined(OEM_COUPLER) && !defined(W5XD_COUPLER)
 #define OEM_COUPLER // The OEM coupler, which, in turn requires a 15/115 input voltage divider at R12/R13/R16/R17
 //#define W5XD_COUPLER // The coupler in ths report, wich requires a 100/320 voltage divider
+#endif
+#if defined(OEM_COUPLER) == defined(W5XD_COUPLER)
+#error "define exactly one of OEM_COUPLER and W5XD_COUPLER"
+#endif
 
 // Use one of the following two
+#if !defined(OEM_METER_SCALES) && !defined(CUSTOM_METER_SCALES)
 #define OEM_METER_SCALES  // the meters are series resistor with PWM=250 is full scale, as painted by Nye Viking
 //#define CUSTOM_METER_SCALES // the meters are series resistor with PWM=250 is full scale, with meter face backings printed per this repo
+#endif
+#if defined(OEM_METER_SCALES) == defined(CUSTOM_METER_SCALES)
+#error "define exactly one of OEM_METER_SCALES and CUSTOM_METER_SCALES"
+#endif
 
 /* The above two compile directives switch between look up table entries. Those look up tables are part of
 ** the elimination of any need floating point at run time, and any need for trig or log functions.
@@ -70,6 +81,18 @@ static_assert(sizeof(uint64_t)==8, "uint64_t");
 ** optiboot loader. That requires changes to boards.txt in the Arduino IDE and, of course,
 ** access to an Arduino as ISP programmer. */
 
+#ifdef BUDGET_MARKERS
+/* For Budget/pmbudget, which runs the sketch under simavr. It times the code between
+** BUDGET_BEGIN and BUDGET_END of the same id by watching writes to GPIOR0, which nothing
+** else here uses. Each is a single OUT instruction. */
+#define BUDGET_BEGIN(id) (GPIOR0 = (id))
+#define BUDGET_END(id) (GPIOR0 = 0x80 | (id))
+#else
+#define BUDGET_BEGIN(id)
+#define BUDGET_END(id)
+#endif
+enum { BUDGET_LOOP = 1, BUDGET_SAMPLE, BUDGET_DISPLAY, BUDGET_COMM }; // as in Budget/pmbudget.cpp
+
 typedef uint16_t AcquiredVolts_t; // maxes at ADC max (1024) * VOLTS_LOW_MULTIPLIER 
 typedef uint32_t DisplayPower_t; // In units of  1/128  Watt (e.g. value 128 is 1 watt )
 namespace {
@@ -111,6 +134,7 @@ namespace {
     // RC input is 100K-33nF = RC=3.3msec or 48KHz
     const long TimerLoopIntervalMicroSec = 1500; // sample frequency is 1/1500 usec = 660Hz sampling
     const unsigned MeterUpdateIntervalMsec = 125; // 8Hz
+    const uint16_t MeterUpdateSamples = MeterUpdateIntervalMsec * 1000L / TimerLoopIntervalMicroSec + 1; // and one for jitter
     const unsigned CommUpdateIntervalMsec = 100; // COM port message throttle
     const unsigned long HoldPwrLampsOnMsec = 500; 
     const unsigned HoldHighLedMsec = 400;
@@ -170,13 +194,38 @@ namespace {
     uint16_t PowerMinToDisplay = 10; // in DisplayPower_t units, 1/128 W
     unsigned AdcMinNonzero = 4;
 
+    const int DIODE_TABLE_ENTRIES = 32; // per direction. see namespace diode
+    const int CAL_POINTS = 8; // see namespace calibrate
+    const int CAL_FIT_BYTES = 6; // calibrate::Fit_t
+    const int CAL_POINT_BYTES = 8; // calibrate::Point_t
+    const int TRIP_RECORDS = 8; // see namespace recorder
+    const int TRIP_RECORD_BYTES = 8; // recorder::Trip_t
+    const int WINDOW_USERS = 4; // see namespace window
+
     enum EEPROM_ASSIGNMENTS {
         EEPROM_SWR_LOCK, EEPROM_PWR_LOCK, EEPROM_FWD_CALIBRATION, EEPROM_REFL_CALIBRATION, EEPROM_POT_MAX,
         EEPROM_POT_REVERSE = EEPROM_POT_MAX + 2,
         EEPROM_IREF, EEPROM_BRIGHTNESS = EEPROM_IREF+2,
         EEPROM_SP3T_REVERSE, EEPROM_MINPWR,
         EEPROM_ADCMIN = EEPROM_MINPWR + 2,
-        EEPROM_USED = EEPROM_ADCMIN + 2
+        EEPROM_DIODE_VALID = EEPROM_ADCMIN + 2,
+        EEPROM_DIODE_FWD,
+        EEPROM_DIODE_REV = EEPROM_DIODE_FWD + DIODE_TABLE_ENTRIES,
+        EEPROM_IDLE_MSEC = EEPROM_DIODE_REV + DIODE_TABLE_ENTRIES,
+        EEPROM_SWR_MODE = EEPROM_IDLE_MSEC + 2,
+        EEPROM_GATE_PERCENT,
+        EEPROM_CAL_VALID,
+        EEPROM_CAL_FWD,
+        EEPROM_CAL_REV = EEPROM_CAL_FWD + CAL_FIT_BYTES,
+        EEPROM_CAL_REFLECTED = EEPROM_CAL_REV + CAL_FIT_BYTES, // bit n for point n
+        EEPROM_CAL_POINTS,
+        EEPROM_TRIG_MASK = EEPROM_CAL_POINTS + CAL_POINTS * CAL_POINT_BYTES,
+        EEPROM_TRIG_SWR,
+        EEPROM_TRIG_PWR,
+        EEPROM_TRIP_NEXT = EEPROM_TRIG_PWR + 2,
+        EEPROM_TRIPS = EEPROM_TRIP_NEXT + 2,
+        EEPROM_WINDOWS = EEPROM_TRIPS + TRIP_RECORDS * TRIP_RECORD_BYTES,
+        EEPROM_USED = EEPROM_WINDOWS + WINDOW_USERS
     };
     uint8_t SwrToMeter(uint16_t swrCoded);
     void PwrToMeter(uint16_t toDisplay); // units of PWR_SCALE
@@ -184,11 +233,92 @@ namespace {
 
 namespace movingAverage{
         void clear();
+        /* The SWR meter, and the Sw: field on the serial port, use one of:
+        ** SWR_AVERAGE  all the samples since the last update
+        ** SWR_GATED    only the samples whose forward voltage is at least GatePercent of the highest
+        **              forward voltage in this update or the previous one. Key up, and the gaps
+        **              between characters and syllables, are left out.
+        ** SWR_PEP      the one sample pair with the highest forward voltage since the last update
+        ** The gated sums and the PEP pair are accumulated in apply(), separately for each reader. */
+        enum SwrMode_t { SWR_AVERAGE, SWR_GATED, SWR_PEP, NUM_SWR_MODES };
+        enum SwrReader_t { SWR_FOR_METER, SWR_FOR_COMM, NUM_SWR_READERS };
+        const uint8_t DEFAULT_GATE_PERCENT = 50;
+        void SetSwrMode(uint8_t mode, uint8_t gatePercent);
+        void PrintSwrMode();
+}
+
+namespace window {
+        /* MULTI-RESOLUTION AVERAGING
+        ** The moving average history is one averaging window. Every sample also goes to a block
+        ** integrator, and each complete block feeds exponential stages, for these windows:
+        **      0   the last complete block of BLOCK_SAMPLES samples, 60 msec
+        **      1   the moving average history, 480 msec. The default for all
+        **      2   exponential, time constant 64 blocks, 3.8 sec
+        **      3   exponential, time constant 1024 blocks, 61 sec
+        ** The exponential averages are of the blocks' mean squares. Their peaks are the blocks'
+        ** peaks, decaying with the same time constant. The times are at the full sample rate.
+        ** "WIN x=w" picks window w for:
+        **      M   the power meter with the front panel switch at AVERAGE
+        **      K   the power meter at PEAK and PEAK HOLD
+        **      A   the average watts on the serial port: SUB A, and Pf: Pr: after P ON
+        **      P   the peak watts on the serial port: SUB P and H, and Pf: Pr: after P PEAK
+        ** and saves it in EEPROM. "WIN" lists them. The SWR meter, the ALO and the flight recorder
+        ** stay on the moving average history. */
+        enum Window_t { WIN_BLOCK, WIN_HISTORY, WIN_SECONDS, WIN_MINUTE, NUM_WINDOWS };
+        enum User_t { METER_AVERAGE, METER_PEAK, SERIAL_AVERAGE, SERIAL_PEAK, NUM_USERS };
+        void SetFromEEPROM();
+        void Set(char user, uint8_t w);
+        void Print();
+        void clear();
+        void apply(AcquiredVolts_t f, AcquiredVolts_t r); // every sample, from movingAverage::apply
+        DisplayPower_t fwdPwr(User_t u); // UNCALIBRATED, as movingAverage::fwdPwr
+        DisplayPower_t revPwr(User_t u);
+        void getPeaks(User_t u, AcquiredVolts_t& f, AcquiredVolts_t& r); // UNCALIBRATED
+}
+
+namespace diode {
+        const uint8_t EEPROM_VALID = 0x5A; // at EEPROM_DIODE_VALID when the tables have been written
+        void SetTablesFromEEPROM();
+        void SetEntry(bool fwd, uint8_t i, int8_t v);
+        void Clear();
+        void Dump();
+        AcquiredVolts_t Volts(uint16_t adc, bool divided, bool fwd); // what sample() makes of an ADC reading
+        /*
+         * HOW TO LINEARIZE THE COUPLER DIODES
+         *
+         * sample() adds the Schottkey barrier voltage to every nonzero ADC reading. At low drive
+         * the detector diodes are not a constant voltage drop, so for the first 320 counts of the
+         * undivided ADC inputs, the amount added is SchottkeyBarrier plus a signed correction
+         * looked up by ADC count in a per-direction table. Above that, and on the divided
+         * inputs, the constant SchottkeyBarrier is used as before.
+         *
+         * The table entries are in AcquiredVolts_t units. Entries 0 through 15 cover
+         * ADC counts 0 through 63 in steps of 4. Entries 16 through 31 cover 64 through 319 in
+         * steps of 16. The entries are filled in from the serial port, multiple points per direction:
+         *
+         * a) Feed the coupler a known RF power, P watts, into a 50 ohm load.
+         * b) Send "ADC" and note fHigh (forward) or rHigh (reflected, with the coupler reversed.)
+         * c) The true detected volts in AcquiredVolts_t units are
+         *      COUPLER_NOMINAL_VOLTS * sqrt(P / COUPLER_NOMINAL_WATTS) * VOLTS_UNDIVIDED_MULTIPLER * 1023 / 5
+         *      (see the constants below)
+         *    and the correction is that value minus (fHigh * VOLTS_UNDIVIDED_MULTIPLER + SchottkeyBarrier)
+         * d) Send "LINF=i,c" (or "LINR=i,c") where i is the table entry for that ADC count and c is the
+         *    correction, -128 through 127. The entry is written to EEPROM.
+         * Repeat at enough power levels to fill in the table. Entries not measured should be
+         * interpolated from their neighbors. Send "LIN" to list both tables.
+         * "LINCLR" reverts both tables to all zero, which is the constant SchottkeyBarrier.
+         */
 }
 
 namespace calibrate {
         void SetCalibrationConstantsFromEEPROM();
         void doCalibrateSetup();
+        const uint8_t EEPROM_VALID = 0xC5; // at EEPROM_CAL_VALID when a fit has been written
+        void StartCapture(uint8_t n, const char *watts);
+        void CaptureUpdate(); // at the meter update
+        void SetFit(char term, char direction, long v);
+        void Print();
+        void Clear();
         /*
          * HOW TO CALIBRATE
          *
@@ -246,6 +376,73 @@ namespace calibrate {
          * AVERAGE: the HOLD pot adjusts the value
          * PEAK&HOLD: the current EEPROM setting is displayed
          * PEAK: write the current settings to EEPROM and end calibration procedure.
+         *
+         *
+         * ********* multipoint calibration from the serial port *****************
+         *
+         * Calibrated volts are gain * v + offset + curve * v * v, per direction, where v
+         * is from sample() and the diode tables. Without a fit, offset and curve are zero and
+         * gain is the power calibration (A) above. The fit is made on the host from points
+         * captured here. NyeVikingClient's nvcal does all of this:
+         *
+         * a) Key a steady carrier, P watts on a reference wattmeter, into a 50 ohm load.
+         * b) Send "CAL n=P", n 0 through CAL_POINTS-1. P may have a fraction, e.g. CAL 2=12.5
+         *    The mean square volts over the next CaptureUpdates meter updates is written to
+         *    EEPROM, in whichever direction had the higher volts. Reverse the coupler to
+         *    capture reflected points. The answer is
+         *      CAL n W:<P in DisplayPower_t> F:<mean square> N:<uncalibrated DisplayPower_t>
+         *    with R: in place of F: for reflected. "CAL n=0" erases point n.
+         * c) "CAL" lists the points, and the fit as CALF G:<gain> O:<offset> C:<curve> and CALR ...
+         * d) The fit sets the terms with "CALG F=g" (or R), gain in 1/32768ths,
+         *    "CALO F=o", offset in AcquiredVolts_t, and "CALC F=c", curve in 1/2**30 per AcquiredVolts_t.
+         *    Setting the gain resets that direction's calibration (A) to nominal, which can
+         *    trim the fitted gain afterwards.
+         * "CALCLR" erases the points and the fit, back to calibration (A) alone.
+         */
+}
+
+namespace recorder {
+        enum { TRIG_ALO = 1, TRIG_SWR = 2, TRIG_PWR = 4 };
+        void SetTriggersFromEEPROM();
+        void Trigger(uint8_t cause, uint16_t age = 0); // TRIG_ bits whose condition holds now,
+                        // caused by the sample age samples before the newest
+        void Sample(AcquiredVolts_t f, AcquiredVolts_t r); // after movingAverage::apply
+        void Update(unsigned long now); // once per loop
+        void SetTriggers(const char *letters);
+        void SetSwr(const char *swr);
+        void SetPwr(uint16_t watts);
+        void PrintTriggers();
+        void PrintTrips();
+        void ClearTrips();
+        void Download();
+        /*
+         * THE FLIGHT RECORDER
+         *
+         * The sample history is gone 480 msec after an ALO trip. The recorder keeps a copy of
+         * the CAPTURE_SAMPLES sample pairs around the most recent trigger, CAPTURE_POST of them
+         * after it, and a summary of each of the last TRIP_RECORDS trips in EEPROM.
+         *
+         * The triggers, any combination:
+         *      A   the ALO lock out turns on. This is up to one meter update after the RF that caused it,
+         *          so the capture is around the sample that did: the highest reflected one the SWR
+         *          meter averaged, or the highest reflected one in the history for the power limit.
+         *      S   a sample's SWR is at or above "TRIGSWR=s", s in tenths, e.g. TRIGSWR=3.5.
+         *          Samples below PMIN forward power don't count.
+         *      P   a sample's forward power is at or above "TRIGPWR=w" watts. TRIGPWR=0 turns it off.
+         * S and P compare the samples before calibration, so are only as close as the calibration is to nominal.
+         * "TRIG=ASP" sets them (TRIG= turns them all off), and "TRIG" lists them. The default is A.
+         * After a trip, nothing triggers again until no trigger condition has held for RearmMsec.
+         *
+         * "TRIPS" lists the summaries, oldest first:
+         *      TRIP <seq> <trigger letters> SWR=<over the capture> F:<peak forward> R:<peak reflected>
+         * where F and R are AcquiredVolts_t, uncalibrated. "TRIPCLR" erases them.
+         *
+         * "RECGET" sends the capture, and the EEPROM it was taken with, in binary. The line
+         *      BIN <n>
+         * ends with a single LF and is followed by n bytes: a Header_t, CAPTURE_SAMPLES
+         * movingAverage::Pair_t, oldest first, EEPROM_USED bytes of EEPROM, and a
+         * Fletcher-16 of all of that, low byte first. The AVR is little endian. NyeVikingClient's
+         * nvrec saves it to a file and PowerMeterHost's pmreplay plays it back through the sketch.
          */
 }
 
@@ -257,6 +454,8 @@ namespace Alo {
 
 namespace sleep {
     void SleepNow();
+    void FirstReading();
+    void ReportWakeLatency();
 
     void pullUpPins(bool on)
     {
@@ -284,10 +483,50 @@ namespace sleep {
     }
 }
 
+namespace rate {
+    /* Between RF going away and the FrontPanelLampsOnMsec timeout putting the CPU to sleep,
+    ** there is no point in sampling at the full rate. After IdleAfterMsec with no RF, loop()
+    ** runs at IdleLoopIntervalMicroSec, and the CPU idles with the ADC off between loops.
+    ** Any nonzero sample, or the coupler's RF detect, returns to the full rate. */
+    enum Rate_t { FULL_RATE, IDLE_RATE, NUM_RATES };
+    void Active(unsigned long now);
+    void Check(unsigned long now);
+    void Wait(unsigned long loopStartedMicros);
+    void Report();
+    uint16_t IdleAfterMsec = 5000; // zero means never idle
+    const long IdleLoopIntervalMicroSec = 20000; // 50Hz
+}
+
+namespace meterUpdate {
+    /* The MeterUpdateIntervalMsec update of the meters, LEDs and ALO runs only when it could
+    ** change something: movingAverage::apply changed the sample history (it bumps Epoch),
+    ** a switch moved, a command arrived, or the last update left something in motion
+    ** (Pending): a needle still moving under its MeterFilter, a hold or range LED timer, or
+    ** an ALO sense that must keep renewing the lock out. With no RF, that is most of them.
+    ** FrontPanelLamps and the sleep decision run either way. "RATE" reports the counts. */
+    uint8_t Epoch;
+    bool Pending; // run the next update even if nothing changed
+    bool Rewrite; // the meter pins were written outside the update. analogWrite them again
+    unsigned long Executed;
+    unsigned long Skipped;
+    bool Due(uint8_t switches);
+    void Report();
+}
+
+namespace sram {
+    /* Before the C runtime initializes static data, Paint() fills the SRAM from the end of
+    ** it to the top of the stack with PAINT. The stack grows down into that, and what it has
+    ** never reached still holds PAINT. The sketch doesn't malloc, so nothing else does.
+    ** "SRAM" reports the static data, the bytes the deepest stack so far left untouched
+    ** (the headroom), and what is free below the stack right now. */
+    void Report();
+}
+
 namespace {
-    void sample();
+    bool sample(); // true if either reading is nonzero
     uint8_t DisplaySwr();
     bool FrontPanelLamps();
+    uint8_t SwitchBits(); // as in Comm's W stream
     enum SetupMode_t { METER_NORMAL, ALO_SETUP, CALIBRATE_SETUP };
 
     // Voltages are in acquisition units.
@@ -317,19 +556,67 @@ namespace {
 
     AcquiredVolts_t fwdCalibration = 0x8000; // this fixed point 1.0 multiplier
     AcquiredVolts_t revCalibration = 0x8000; // ditto
+    // the rest of a multipoint fit. See namespace calibrate
+    int16_t fwdCalOffset; // AcquiredVolts_t
+    int16_t revCalOffset;
+    int16_t fwdCalCurve; // 1/2**30 per AcquiredVolts_t
+    int16_t revCalCurve;
+    bool calibrateGainOnly = true; // all four of those are zero
+
+    // Square root, rounded down, of a mean square of AcquiredVolts_t
+    AcquiredVolts_t rootOf(uint32_t s)
+    {
+        uint32_t root = 0;
+        for (uint32_t bit = 1ul << 30; bit != 0; bit >>= 2)
+        {
+            if (s >= root + bit)
+            {
+                s -= root + bit;
+                root = (root >> 1) + bit;
+            }
+            else
+                root >>= 1;
+        }
+        return static_cast<AcquiredVolts_t>(root);
+    }
+
+    // gain * v + offset + curve * v * v. A zero reading stays zero
+    AcquiredVolts_t calibrateCurve(AcquiredVolts_t v, AcquiredVolts_t gain, int16_t offset, int16_t curve)
+    {
+        if (v == 0)
+            return 0;
+        int32_t t = (static_cast<uint32_t>(v) * gain + 0x4000) >> 15;
+        t += offset;
+        int32_t sq = (static_cast<uint32_t>(v) * v) >> 15; // less than 2**15
+        t += (sq * curve) / 0x8000;
+        if (t < 1)
+            return 1;
+        if (t > 0xFFFF)
+            return 0xFFFF;
+        return static_cast<AcquiredVolts_t>(t);
+    }
 
     uint32_t calibrateScaleFwd(uint32_t v)
     {
-        v *= revCalibration;
+        v *= fwdCalibration;
         v /= 0x8000u;
         return v;
     }
 
     AcquiredVolts_t calibrateFwd(AcquiredVolts_t v)
-    {  return (AcquiredVolts_t)calibrateScaleFwd(v);   }
+    {
+        if (calibrateGainOnly)
+            return (AcquiredVolts_t)calibrateScaleFwd(v);
+        return calibrateCurve(v, fwdCalibration, fwdCalOffset, fwdCalCurve);
+    }
 
     DisplayPower_t calibrateFwdPower(DisplayPower_t w)
     {
+        if (!calibrateGainOnly)
+        {   // the curve is fitted to a steady carrier, so the root mean square is good enough
+            DisplayPower_t v = calibrateFwd(rootOf(w));
+            return v * v;
+        }
         uint64_t t = w;
         t *= fwdCalibration;
         t *= fwdCalibration;
@@ -346,10 +633,19 @@ namespace {
     }
 
     AcquiredVolts_t calibrateRev(AcquiredVolts_t v)
-    {  return (AcquiredVolts_t)calibrateScaleRev(v);  }
+    {
+        if (calibrateGainOnly)
+            return (AcquiredVolts_t)calibrateScaleRev(v);
+        return calibrateCurve(v, revCalibration, revCalOffset, revCalCurve);
+    }
 
     DisplayPower_t calibrateRevPower(DisplayPower_t w)
     {
+        if (!calibrateGainOnly)
+        {
+            DisplayPower_t v = calibrateRev(rootOf(w));
+            return v * v;
+        }
         uint64_t t = w;
         t *= revCalibration;
         t *= revCalibration;
@@ -358,6 +654,34 @@ namespace {
         return (DisplayPower_t)t;
     }
 
+    /* f and r are sums of count samples. Calibrates them to each other, for SWR.
+    ** With a gain only, they are divided by a power of two near count, which
+    ** the ratio doesn't care about. Offset and curve need the mean */
+    void calibrateSums(uint32_t &f, uint32_t &r, unsigned count)
+    {
+        if (!calibrateGainOnly)
+        {
+            if (count > 1)
+            {
+                f /= count;
+                r /= count;
+            }
+            f = calibrateFwd(static_cast<AcquiredVolts_t>(f));
+            r = calibrateRev(static_cast<AcquiredVolts_t>(r));
+            return;
+        }
+        for (;;)
+        {
+            count >>= 1;
+            if (count == 0)
+                break;
+            f >>= 1;
+            r >>= 1;
+        }
+        f = calibrateScaleFwd(f);
+        r = calibrateScaleRev(r);
+    }
+
     uint16_t readHoldPot();
     void AdcTest();
 }
@@ -369,6 +693,21 @@ namespace Comm {
         bool forever = false;
         void CommUpdateForwardAndReverse();
         const unsigned long OUTPUT_TIMEOUT_MSEC = 10000;
+        /* Subscriptions. SUB x=n sends stream x every n'th CommUpdateIntervalMsec, 0 stops it.
+        ** Every stream due on an update goes on one line, with Tm:
+        **      A   Fa: Ra: average watts, in DisplayPower_t, over window "WIN A"
+        **      P   Fp: Rp: peak watts over window "WIN P". See namespace window
+        **      H   Fh: Rh: highest peak since this stream was last sent
+        **      S   Sw: SWR per SWRMODE, over the samples since it was last sent
+        **      L   Ls: bit 0 ALO lock out, bit 1 RF sense, bit 2 front panel lamps
+        **      W   Ws: bits 0-1 front panel switch 0 PEAK HOLD 1 PEAK 2 AVERAGE,
+        **              bit 2 back panel power switch on FWD, bit 3 back panel ALO switch on SWR
+        ** They time out with P ON and P PEAK, and any of those commands restarts the timeout for all.
+        ** Repeating SUB x=n with the n x already has only restarts the timeout. */
+        enum Stream_t { STREAM_AVERAGE, STREAM_PEAK, STREAM_HOLD, STREAM_SWR, STREAM_LOCK, STREAM_SWITCHES, NUM_STREAMS };
+        void Subscribe(char which, uint8_t decimation);
+        void PrintSubscriptions();
+        void StopOutput();
 }
 
 static void get_mcusr();
@@ -399,6 +738,7 @@ void setup() {
     movingAverage::clear();
 
     calibrate::SetCalibrationConstantsFromEEPROM();
+    diode::SetTablesFromEEPROM();
     digitalWrite(PanelLampsPinOut, HIGH); // turn on front panel lights on boot
 
     Wire.begin();
@@ -459,6 +799,21 @@ void setup() {
         AdcMinNonzero = pmin;
     Serial.print(F("ADCMIN="));
     Serial.println(AdcMinNonzero);
+    EEPROM.get((int)EEPROM_IDLE_MSEC, pmin);
+    if (pmin != 0xFFFF)
+        rate::IdleAfterMsec = pmin;
+    Serial.print(F("IDLE="));
+    Serial.println(rate::IdleAfterMsec);
+    Serial.print(F("Diode table = "));
+    Serial.println(EEPROM.read((int)EEPROM_DIODE_VALID) == diode::EEPROM_VALID ? F("EEPROM") : F("default"));
+    Serial.print(F("Multipoint CAL = "));
+    Serial.println(EEPROM.read((int)EEPROM_CAL_VALID) == calibrate::EEPROM_VALID ? F("EEPROM") : F("none"));
+    recorder::SetTriggersFromEEPROM();
+    recorder::PrintTriggers();
+    window::SetFromEEPROM();
+    window::Print();
+    movingAverage::SetSwrMode(EEPROM.read((int)EEPROM_SWR_MODE), EEPROM.read((int)EEPROM_GATE_PERCENT));
+    movingAverage::PrintSwrMode();
 
 #ifdef SUPPORT_WDT
     wdt_enable(WDTO_1S);
@@ -468,8 +823,11 @@ void setup() {
 }
 
 namespace cmd {
-    enum COMMAND_ENUM { P_ON, P_OFF, P_PEAK, P_FOREVER, POTREVERSE, POTMAX, SP3TUPDOWN, PMIN, POT, IREF,LED, METERS, ADCX, BRI, DUMP, RSCALI, ADCMIN, NUM_COMMANDS};
+    enum COMMAND_ENUM { P_ON, P_OFF, P_PEAK, P_FOREVER, POTREVERSE, POTMAX, SP3TUPDOWN, PMIN, POT, IREF,LED, METERS, ADCX, BRI, DUMP, RSCALI, ADCMIN,
+        LINF, LINR, LIN, LINCLR, IDLE, RATE, SWRMODE, GATE, PING, SUB, CAL, CALCLR,
+        TRIG, TRIGSWR, TRIGPWR, TRIPS, TRIPCLR, RECGET, SRAM, WIN, NUM_COMMANDS};
     const int MAX_COMMAND_LEN = 12;
+    const int MAX_LINE_LEN = 18; // the longest documented is SWRMODE=AVERAGE, 15
     const char c0[] PROGMEM = "P ON";
     const char c1[] PROGMEM = "P OFF";
     const char c2[] PROGMEM = "P PEAK";
@@ -487,8 +845,29 @@ namespace cmd {
     const char c14[] PROGMEM = "DUMP";
     const char c15[] PROGMEM = "RSCALI";
     const char c16[] PROGMEM = "ADCMIN=";
-    const char *const tbl[NUM_COMMANDS] PROGMEM = {c0, c1, c2, c3, c4, c5, c6, c7, c8, c9, c10, c11, c12, c13, c14, c15, c16};
-    static_assert(NUM_COMMANDS == 17, "command table mismatch");
+    const char c17[] PROGMEM = "LINF=";
+    const char c18[] PROGMEM = "LINR=";
+    const char c19[] PROGMEM = "LIN";
+    const char c20[] PROGMEM = "LINCLR";
+    const char c21[] PROGMEM = "IDLE=";
+    const char c22[] PROGMEM = "RATE";
+    const char c23[] PROGMEM = "SWRMODE=";
+    const char c24[] PROGMEM = "GATE=";
+    const char c25[] PROGMEM = "PING=";
+    const char c26[] PROGMEM = "SUB";
+    const char c27[] PROGMEM = "CAL";
+    const char c28[] PROGMEM = "CALCLR";
+    const char c29[] PROGMEM = "TRIG";
+    const char c30[] PROGMEM = "TRIGSWR=";
+    const char c31[] PROGMEM = "TRIGPWR=";
+    const char c32[] PROGMEM = "TRIPS";
+    const char c33[] PROGMEM = "TRIPCLR";
+    const char c34[] PROGMEM = "RECGET";
+    const char c35[] PROGMEM = "SRAM";
+    const char c36[] PROGMEM = "WIN";
+    const char *const tbl[NUM_COMMANDS] PROGMEM = {c0, c1, c2, c3, c4, c5, c6, c7, c8, c9, c10, c11, c12, c13, c14, c15, c16,
+        c17, c18, c19, c20, c21, c22, c23, c24, c25, c26, c27, c28, c29, c30, c31, c32, c33, c34, c35, c36};
+    static_assert(NUM_COMMANDS == 37, "command table mismatch");
 
     int strncmp(const char *b, COMMAND_ENUM e, uint8_t len)
     {
@@ -504,6 +883,7 @@ namespace cmd {
 
 void loop()
 {
+    BUDGET_BEGIN(BUDGET_LOOP);
 #ifdef SUPPORT_WDT
     wdt_reset();
 #endif
@@ -514,7 +894,7 @@ void loop()
     while (Serial.available() > 0)
     {
         static unsigned char numInBuf = 0;
-        static char buf[16];
+        static char buf[cmd::MAX_LINE_LEN + 2]; // and the terminator
         auto inChar = Serial.read();
         if (islower(inChar))
             inChar = toupper(inChar);
@@ -527,8 +907,8 @@ void loop()
                 Comm::OutputToSerial = Comm::AVG_OUTPUT_TO_SERIAL;
                 Comm::OutputStartedMsec = now;
             }
-            else if (cmd::strcmp(buf, cmd::P_OFF) == 0) // don't send serial port power
-                Comm::OutputToSerial = Comm::NO_OUTPUT_TO_SERIAL;
+            else if (cmd::strcmp(buf, cmd::P_OFF) == 0) // don't send serial port power, nor subscriptions
+                Comm::StopOutput();
             else if (cmd::strcmp(buf, cmd::P_PEAK) == 0)
             {   // send serial port PEAK power output
                 Comm::OutputToSerial = Comm::PEAK_OUTPUT_TO_SERIAL;
@@ -569,6 +949,7 @@ void loop()
                 /* Units of 1/128W, set the minium power to keep the display turned on */
                 PowerMinToDisplay = atoi(buf+5);
                 EEPROM.put((int)EEPROM_MINPWR, PowerMinToDisplay);
+                recorder::SetTriggersFromEEPROM(); // the SWR trigger's floor
             }
             else if (cmd::strcmp(buf, cmd::POT) == 0)
             {   /* diagnostic hold pot readout*/
@@ -645,6 +1026,109 @@ void loop()
                 AdcMinNonzero = atoi(buf + 7);
                 EEPROM.put((int)EEPROM_ADCMIN, AdcMinNonzero);
             }
+            else if (cmd::strncmp(buf, cmd::LINF, 5) == 0 || cmd::strncmp(buf, cmd::LINR, 5) == 0)
+            {   /* LINF=i,c sets diode table entry i to correction c. See namespace diode*/
+                const char *comma = strchr(buf + 5, ',');
+                long i = atol(buf + 5);
+                long c = comma != 0 ? atol(comma + 1) : 0;
+                if (comma != 0 && i >= 0 && i < DIODE_TABLE_ENTRIES && c >= -128 && c <= 127)
+                    diode::SetEntry(buf[3] == 'F', static_cast<uint8_t>(i), static_cast<int8_t>(c));
+                else
+                {
+                    Serial.print(F("LIN error: i is 0 to "));
+                    Serial.print(DIODE_TABLE_ENTRIES - 1);
+                    Serial.println(F(", c is -128 to 127"));
+                }
+            }
+            else if (cmd::strcmp(buf, cmd::LIN) == 0)
+                diode::Dump();
+            else if (cmd::strcmp(buf, cmd::LINCLR) == 0)
+                diode::Clear();
+            else if (cmd::strncmp(buf, cmd::IDLE, 5) == 0)
+            {   /* msec with no RF before dropping to the idle sample rate. 0 is never*/
+                rate::IdleAfterMsec = atoi(buf + 5);
+                EEPROM.put((int)EEPROM_IDLE_MSEC, rate::IdleAfterMsec);
+            }
+            else if (cmd::strcmp(buf, cmd::RATE) == 0)
+            {
+                rate::Report();
+                meterUpdate::Report();
+            }
+            else if (cmd::strncmp(buf, cmd::SWRMODE, 8) == 0)
+            {   /* SWRMODE=AVERAGE, GATED or PEP. Only the first letter counts. See namespace movingAverage*/
+                uint8_t m = buf[8] == 'G' ? movingAverage::SWR_GATED :
+                    buf[8] == 'P' ? movingAverage::SWR_PEP : movingAverage::SWR_AVERAGE;
+                EEPROM.write((int)EEPROM_SWR_MODE, m);
+                movingAverage::SetSwrMode(m, EEPROM.read((int)EEPROM_GATE_PERCENT));
+                movingAverage::PrintSwrMode();
+            }
+            else if (cmd::strncmp(buf, cmd::GATE, 5) == 0)
+            {   /* GATE=n, 1 through 99 percent of peak forward volts for SWRMODE=GATED*/
+                EEPROM.write((int)EEPROM_GATE_PERCENT, atoi(buf + 5));
+                movingAverage::SetSwrMode(EEPROM.read((int)EEPROM_SWR_MODE), EEPROM.read((int)EEPROM_GATE_PERCENT));
+                movingAverage::PrintSwrMode();
+            }
+            else if (cmd::strcmp(buf, cmd::SUB) == 0)
+                Comm::PrintSubscriptions();
+            else if (cmd::strncmp(buf, cmd::SUB, 3) == 0 && buf[3] == ' ' && buf[5] == '=')
+            {   /* SUB x=n. See namespace Comm */
+                Comm::Subscribe(buf[4], atoi(buf + 6));
+                Comm::OutputStartedMsec = now;
+            }
+            else if (cmd::strcmp(buf, cmd::CAL) == 0)
+                calibrate::Print();
+            else if (cmd::strcmp(buf, cmd::CALCLR) == 0)
+                calibrate::Clear();
+            else if (cmd::strncmp(buf, cmd::CAL, 3) == 0 && buf[3] == ' ' && buf[5] == '=')
+            {   /* CAL n=watts captures point n. See namespace calibrate */
+                calibrate::StartCapture(buf[4] - '0', buf + 6);
+            }
+            else if (cmd::strncmp(buf, cmd::CAL, 3) == 0 && buf[4] == ' ' && buf[6] == '=')
+            {   /* CALG F=g, CALO R=o, CALC F=c and so on set the fit */
+                calibrate::SetFit(buf[3], buf[5], atol(buf + 7));
+                calibrate::Print();
+            }
+            else if (cmd::strcmp(buf, cmd::TRIG) == 0)
+                recorder::PrintTriggers();
+            else if (cmd::strncmp(buf, cmd::TRIG, 4) == 0 && buf[4] == '=')
+            {   /* TRIG=ASP, any of them. See namespace recorder */
+                recorder::SetTriggers(buf + 5);
+                recorder::PrintTriggers();
+            }
+            else if (cmd::strncmp(buf, cmd::TRIGSWR, 8) == 0)
+            {
+                recorder::SetSwr(buf + 8);
+                recorder::PrintTriggers();
+            }
+            else if (cmd::strncmp(buf, cmd::TRIGPWR, 8) == 0)
+            {
+                recorder::SetPwr(atoi(buf + 8));
+                recorder::PrintTriggers();
+            }
+            else if (cmd::strcmp(buf, cmd::TRIPS) == 0)
+                recorder::PrintTrips();
+            else if (cmd::strcmp(buf, cmd::TRIPCLR) == 0)
+                recorder::ClearTrips();
+            else if (cmd::strcmp(buf, cmd::RECGET) == 0)
+                recorder::Download();
+            else if (cmd::strcmp(buf, cmd::SRAM) == 0)
+                sram::Report();
+            else if (cmd::strcmp(buf, cmd::WIN) == 0)
+                window::Print();
+            else if (cmd::strncmp(buf, cmd::WIN, 3) == 0 && buf[3] == ' ' && buf[5] == '=')
+            {   /* WIN x=w. See namespace window */
+                window::Set(buf[4], atoi(buf + 6));
+                window::Print();
+            }
+            else if (cmd::strncmp(buf, cmd::PING, 5) == 0)
+            {   /* PING=n answers PONG=n Tm:<micros()>, stamped as soon as the PING is complete.
+                ** The host times these to map the Tm: on each record to its own clock.*/
+                unsigned long t = micros();
+                Serial.print(F("PONG="));
+                Serial.print(buf + 5);
+                Serial.print(F(" Tm:"));
+                Serial.println(t);
+            }
             else if (cmd::strncmp(buf, cmd::BRI, 4) == 0)
             {   /* 0-255 sets the duty cycle on the LEDS. 255 brightest*/
                 uint8_t v = atoi(buf + 4);
@@ -674,12 +1158,21 @@ void loop()
             ** the printouts from the setup() routine above after 1 second */
 #endif
             numInBuf = 0;
+            meterUpdate::Pending = true; // whatever it was, show its effect now
         }
         else numInBuf += 1;
         if (numInBuf >= sizeof(buf) - 1)
             numInBuf = 0;
     }
-    sample(); // read FWD/REFL ADCs
+    BUDGET_BEGIN(BUDGET_SAMPLE);
+    bool sampled = sample(); // read FWD/REFL ADCs
+    BUDGET_END(BUDGET_SAMPLE);
+    if (sampled)
+    {
+        sleep::FirstReading();
+        rate::Active(now);
+    }
+    sleep::ReportWakeLatency();
 
     BackPanelPwrSwitchFwd = digitalRead(PowerForwReflSwitchPinIn) == HIGH;
     BackPanelAloSwitchSwr = digitalRead(ALOtripSwitchPinIn) == HIGH;
@@ -694,9 +1187,12 @@ void loop()
         digitalWrite(PanelLampsPinOut, HIGH);
         coupler7dot5LastHeardMillis = now;
         EnteredAloSetupModeTime = now;
+        rate::Active(now);
     }
 
     // dispatch per MeterMode
+    if (MeterMode != METER_NORMAL)
+        meterUpdate::Rewrite = true; // the setups analogWrite the meters themselves
     if (MeterMode == ALO_SETUP)
     {
         Alo::doAloSetup();
@@ -719,6 +1215,7 @@ void loop()
     {   // RF detect activated
         coupler7dot5LastHeardMillis = now;
         digitalWrite(PanelLampsPinOut, HIGH);
+        rate::Active(now);
     }
 
     if (leds.GetAloLock() &&
@@ -728,156 +1225,634 @@ void loop()
     }
 
     if (!Comm::forever && (now - Comm::OutputStartedMsec > Comm::OUTPUT_TIMEOUT_MSEC))
-        Comm::OutputToSerial = Comm::NO_OUTPUT_TO_SERIAL;
+        Comm::StopOutput();
 
     if (now - CommUpdateTime >= CommUpdateIntervalMsec)
     {
         CommUpdateTime = now;
+        BUDGET_BEGIN(BUDGET_COMM);
         Comm::CommUpdateForwardAndReverse();
+        BUDGET_END(BUDGET_COMM);
     }
 
     // Update the displays less frequently than loop() can excute
     if (now - SwrUpdateTime >= MeterUpdateIntervalMsec)
     {
         SwrUpdateTime = now;
-        uint8_t swr = DisplaySwr();
-        DisplayPower_t pwr;
-        if (digitalRead(PeakSwitchPinIn) == LOW)
-            pwr = getPeakPwr();
-        else if (digitalRead(AverageSwitchPinIn) == LOW)
-            pwr = getAveragePwr();
-        else
-            pwr = getPeakHoldPwr();
-        DisplayPwr(pwr);
-        if (BackPanelAloSwitchSwr)
-            Alo::CheckAloSwr(swr);
-        else
-            Alo::CheckAloPwr();
+        BUDGET_BEGIN(BUDGET_DISPLAY);
+        uint8_t switches = SwitchBits();
+        if (meterUpdate::Due(switches))
+        {   // something changed since the last update. See namespace meterUpdate
+            uint8_t swr = DisplaySwr();
+            DisplayPower_t pwr;
+            if (switches & 1)
+                pwr = getPeakPwr();
+            else if (switches & 2)
+                pwr = getAveragePwr();
+            else
+                pwr = getPeakHoldPwr();
+            DisplayPwr(pwr);
+            if (BackPanelAloSwitchSwr)
+                Alo::CheckAloSwr(swr);
+            else
+                Alo::CheckAloPwr();
+            meterUpdate::Rewrite = false;
+        }
+        calibrate::CaptureUpdate();
+        BUDGET_END(BUDGET_DISPLAY);
         if (!FrontPanelLamps())
         {
             leds.sleep();
             sleep::SleepNow();
             leds.wake();
+            meterUpdate::Rewrite = true; // SleepNow drove the meters LOW
         }
     }
 
-    // 
-    unsigned long nowusec = micros();
-    long diff = nowusec - previousMicrosec;
-    diff -= TimerLoopIntervalMicroSec;
-    if ((diff < 0) && (diff >= -TimerLoopIntervalMicroSec))
-        delayMicroseconds((unsigned int)-diff);
+    recorder::Update(now);
+    rate::Check(now);
+    BUDGET_END(BUDGET_LOOP);
+    rate::Wait(previousMicrosec);
 }
 
 namespace movingAverage {
     // A dot-length at 13wpm is 92msec
-    // run moving average over power of 2 samples for cheap divide
-    // 256 sample moving average
-    // * 1.5 msec sample interval = 384msec history length
-    const int PWR_TO_AVERAGE = 8; // takes up 512 bytes out of 2048 total on UNO
-    const int NUM_TO_AVERAGE = 1 << PWR_TO_AVERAGE;
+    // 320 sample moving average
+    // * 1.5 msec sample interval = 480msec history length
+    const int NUM_TO_AVERAGE = 320; // 5 << 6. See fwdPwr()
+    const int PACKED_BYTES = 3;
     int curIndex;
 
+    /* The history keeps each sample pair as sample() read it: the forward and reflected
+    ** ADC counts, 10 bits each, and whether they came from the divided inputs. sample()
+    ** switches both to the divided inputs together, so one bit does for the pair.
+    ** diode::Volts() turns them back into exactly the AcquiredVolts_t sample() made of them.
+    ** 320 pairs take 960 bytes out of 2048 total on UNO, where 256 pairs of AcquiredVolts_t took 1024.
+    **  b[0]    forward bits 0-7
+    **  b[1]    forward bits 8-9 in bits 0-1, reflected bits 0-5 in bits 2-7
+    **  b[2]    reflected bits 6-9 in bits 0-3, DIVIDED */
+    struct Pair_t
+    {
+        enum { DIVIDED = 0x10 };
+        uint8_t b[PACKED_BYTES];
+
+        uint16_t fwd() const { return b[0] | (static_cast<uint16_t>(b[1] & 0x3) << 8); }
+        uint16_t rev() const { return (b[1] >> 2) | (static_cast<uint16_t>(b[2] & 0xf) << 6); }
+        bool divided() const { return (b[2] & DIVIDED) != 0; }
+        AcquiredVolts_t fwdVolts() const { return diode::Volts(fwd(), divided(), true); }
+        AcquiredVolts_t revVolts() const { return diode::Volts(rev(), divided(), false); }
+
+        static Pair_t pack(uint16_t fwd, uint16_t rev, bool divided)
+        {
+            Pair_t p;
+            p.b[0] = static_cast<uint8_t>(fwd);
+            p.b[1] = static_cast<uint8_t>(((fwd >> 8) & 0x3) | (rev << 2));
+            p.b[2] = static_cast<uint8_t>(((rev >> 6) & 0xf) | (divided ? DIVIDED : 0));
+            return p;
+        }
+    };
+    static_assert(sizeof(Pair_t) == PACKED_BYTES, "Pair_t packing");
+
     // The "acquisition" units for power are what we get from the ADC, times
     // what we used to acquire it (VOLTS_LOW_MULTIPLIER or VOLTS_UNDIVIDED_MULTIPLIER)
     // The ADC is 10 bits, so multiplying by those still keeps us within 16 bit unsigned
 
-    AcquiredVolts_t fwdHistory[NUM_TO_AVERAGE]; // units are ADC converter units
-    AcquiredVolts_t revHistory[NUM_TO_AVERAGE];
-    uint64_t fwdTotal;
+    Pair_t history[NUM_TO_AVERAGE];
+    uint64_t fwdTotal; // sums of the squares of the history's volts
     uint64_t revTotal;
+    bool peaksValid; // peakF and peakR are from the history as it is now
+    AcquiredVolts_t peakF;
+    AcquiredVolts_t peakR;
+    int peakFIndex; // where in the history they are
+    int peakRIndex;
+
+    uint16_t Applied; // samples apply() has taken, mod 1 << 16
 
+    /* Sums of the samples applied since the last getCalibratedSums(). accumulate() adds the
+    ** new ones without reading them out. The history holds only NUM_TO_AVERAGE of them, so
+    ** a reader has to accumulate at least that often, or it gets only the newest ones. */
     class AvgSinceLastCheck
     {
     public:
-        AvgSinceLastCheck(int start = 0) : lastIndex(start) {}
+        AvgSinceLastCheck() : lastApplied(0), fSum(0), rSum(0), count(0) {}
 
-        // expect to be called at meter update frequency: 8Hz
-        // BEWARE. f/r are calibrated TO EACH OTHER ONLY
-        void getCalibratedSums(uint32_t& f, uint32_t& r)
+        // at most the newest "most" samples. If more went by, what was accumulated before is dropped
+        void accumulate(uint16_t most = NUM_TO_AVERAGE)
         {
-            f = 0; r = 0;
-            // backwards from newest sample
-            // stop at sample we used last time called
-            unsigned count = 0;
-            for (int i = curIndex; i != lastIndex; )
+            uint16_t n = Applied - lastApplied;
+            lastApplied = Applied;
+            if (most > NUM_TO_AVERAGE)
+                most = NUM_TO_AVERAGE;
+            if (n > most)
             {
-                f += fwdHistory[i];
-                r += revHistory[i];
+                n = most;
+                fSum = rSum = 0;
+                count = 0;
+            }
+            int i = curIndex - static_cast<int>(n);
+            if (i < 0)
+                i += NUM_TO_AVERAGE;
+            for (; n != 0; n--)
+            {   // oldest first
+                fSum += history[i].fwdVolts();
+                rSum += history[i].revVolts();
                 count += 1;
-                if (--i < 0)
-                    i = NUM_TO_AVERAGE - 1;
+                if (++i >= NUM_TO_AVERAGE)
+                    i = 0;
             }
-            // optimize the divide by count to nearby power of two
-            // Only the ratio of f and r will be used to compute SWR
-            for (;;)
-            {
+            if (count >= MAX_COUNT)
+            {   // nobody is reading. The ratio is what matters
+                fSum >>= 1;
+                rSum >>= 1;
                 count >>= 1;
-                if (count == 0)
-                    break;
-                f >>= 1;
-                r >>= 1;
             }
-            f = calibrateScaleFwd(f);
-            r = calibrateScaleRev(r);
-            lastIndex = curIndex;
+        }
+
+        // expect to be called at meter update frequency: 8Hz
+        // BEWARE. f/r are calibrated TO EACH OTHER ONLY
+        void getCalibratedSums(uint32_t& f, uint32_t& r, uint16_t most = NUM_TO_AVERAGE)
+        {
+            accumulate(most);
+            f = fSum;
+            r = rSum;
+            // Only the ratio of f and r will be used to compute SWR
+            calibrateSums(f, r, count);
+            fSum = rSum = 0;
+            count = 0;
         }
 
     private:
-        int lastIndex;
+        static const uint16_t MAX_COUNT = 1 << 12;
+        uint16_t lastApplied;
+        uint32_t fSum;
+        uint32_t rSum;
+        uint16_t count;
     };
 
-    void clear()
+    SwrMode_t SwrMode = SWR_AVERAGE;
+    uint8_t GatePercent = DEFAULT_GATE_PERCENT;
+    uint16_t Gate256; // GatePercent in 1/256 units
+
+    struct SwrWindow
+    {
+        uint32_t f; // sums of the samples through the gate
+        uint32_t r;
+        uint16_t count;
+        AcquiredVolts_t peak; // forward, this window
+        AcquiredVolts_t threshold;
+        AcquiredVolts_t pepF; // the pair at peak
+        AcquiredVolts_t pepR;
+    };
+    SwrWindow swrWindows[NUM_SWR_READERS];
+    const uint16_t MAX_GATED_COUNT = 1 << 12; // halve the sums here, in case nobody reads them
+
+    void gate(SwrWindow &w, AcquiredVolts_t f, AcquiredVolts_t r)
     {
-        for (unsigned i = 0; i < NUM_TO_AVERAGE; i++)
+        if (f == 0)
+            return;
+        if (f > w.peak)
         {
-            fwdHistory[i] = 0;
-            revHistory[i] = 0;
+            w.peak = f;
+            w.pepF = f;
+            w.pepR = r;
+            AcquiredVolts_t t = (static_cast<uint32_t>(f) * Gate256) >> 8;
+            if (t > w.threshold)
+                w.threshold = t;
         }
+        if (f >= w.threshold)
+        {
+            w.f += f;
+            w.r += r;
+            if (++w.count >= MAX_GATED_COUNT)
+            {
+                w.f >>= 1;
+                w.r >>= 1;
+                w.count >>= 1;
+            }
+        }
+    }
+
+    void clearSwrWindows()
+    {
+        memset(swrWindows, 0, sizeof(swrWindows));
+    }
+
+    void SetSwrMode(uint8_t mode, uint8_t gatePercent)
+    {
+        SwrMode = mode < NUM_SWR_MODES ? static_cast<SwrMode_t>(mode) : SWR_AVERAGE;
+        GatePercent = (gatePercent > 0 && gatePercent < 100) ? gatePercent : DEFAULT_GATE_PERCENT;
+        Gate256 = (static_cast<uint16_t>(GatePercent) << 8) / 100;
+        clearSwrWindows();
+    }
+
+    void PrintSwrMode()
+    {
+        Serial.print(F("SWRMODE="));
+        Serial.print(SwrMode == SWR_GATED ? F("GATED") : SwrMode == SWR_PEP ? F("PEP") : F("AVERAGE"));
+        Serial.print(F(" GATE="));
+        Serial.println(GatePercent);
+    }
+
+    /* Replaces f and r, from AvgSinceLastCheck, with the gated sums or the PEP pair
+    ** for this reader, calibrated the same way. Starts the reader's next window.
+    ** Does nothing in SWR_AVERAGE. */
+    void getSwrSums(SwrReader_t which, uint32_t& f, uint32_t& r)
+    {
+        if (SwrMode == SWR_AVERAGE)
+            return;
+        SwrWindow &w = swrWindows[which];
+        if (SwrMode == SWR_PEP)
+        {
+            f = w.pepF;
+            r = w.pepR;
+            calibrateSums(f, r, 1);
+        }
+        else
+        {
+            f = w.f;
+            r = w.r;
+            calibrateSums(f, r, w.count);
+        }
+        AcquiredVolts_t next = (static_cast<uint32_t>(w.peak) * Gate256) >> 8;
+        memset(&w, 0, sizeof(w));
+        w.threshold = next; // the next window gates on this one's peak, until it has its own
+    }
+
+    void clear()
+    {
+        memset(history, 0, sizeof(history));
         fwdTotal = 0;
         revTotal = 0;
+        peaksValid = false;
+        meterUpdate::Epoch += 1;
+        clearSwrWindows();
+        window::clear();
     }
 
-    void apply(AcquiredVolts_t f, AcquiredVolts_t r)
+    // p as sample() read it. f and r are its volts
+    void apply(const Pair_t &p, AcquiredVolts_t f, AcquiredVolts_t r)
     {
-        fwdTotal -= (long)fwdHistory[curIndex] * fwdHistory[curIndex];
-        revTotal -= (long)revHistory[curIndex] * revHistory[curIndex];
-        fwdTotal += (long)f * f;
-        revTotal += (long)r * r;
-        fwdHistory[curIndex] = f;
-        revHistory[curIndex++] = r;
+        window::apply(f, r);
+        if (SwrMode != SWR_AVERAGE)
+            for (uint8_t i = 0; i < NUM_SWR_READERS; i++)
+                gate(swrWindows[i], f, r);
+        Pair_t &oldest = history[curIndex];
+        if (memcmp(&oldest, &p, sizeof(p)) != 0)
+        {   // with no RF, zeros overwrite zeros and nothing downstream needs to know
+            AcquiredVolts_t oldF = oldest.fwdVolts();
+            AcquiredVolts_t oldR = oldest.revVolts();
+            fwdTotal -= (long)oldF * oldF;
+            revTotal -= (long)oldR * oldR;
+            fwdTotal += (long)f * f;
+            revTotal += (long)r * r;
+            oldest = p;
+            if (peaksValid)
+            {
+                if (curIndex == peakFIndex || curIndex == peakRIndex)
+                    peaksValid = false; // a peak is leaving the window. getPeaks() looks for the next
+                else
+                {
+                    if (f > peakF)
+                    {
+                        peakF = f;
+                        peakFIndex = curIndex;
+                    }
+                    if (r > peakR)
+                    {
+                        peakR = r;
+                        peakRIndex = curIndex;
+                    }
+                }
+            }
+            meterUpdate::Epoch += 1;
+        }
+        curIndex += 1;
         if (curIndex >= NUM_TO_AVERAGE)
             curIndex = 0;
+        Applied += 1;
     }
 
     // UNCALIBRATED
     DisplayPower_t fwdPwr()
-    {
-        uint64_t f = fwdTotal;
-        f += 1 << (PWR_TO_AVERAGE - 1);
-        f >>= PWR_TO_AVERAGE;
-        return (DisplayPower_t)f;
+    {   // 320 of the largest AcquiredVolts_t, squared, are under 1 << 38
+        static_assert(NUM_TO_AVERAGE == 5 << 6, "fwdPwr divides by 5 << 6");
+        uint32_t f = static_cast<uint32_t>((fwdTotal + (NUM_TO_AVERAGE / 2)) >> 6);
+        return (DisplayPower_t)(f / 5);
     }
 
     // UNCALIBRATED
     DisplayPower_t revPwr()
     {
-        uint64_t r = revTotal;
-        r += 1 << (PWR_TO_AVERAGE - 1);
-        r >>= PWR_TO_AVERAGE;
-        return (DisplayPower_t)r;
+        uint32_t r = static_cast<uint32_t>((revTotal + (NUM_TO_AVERAGE / 2)) >> 6);
+        return (DisplayPower_t)(r / 5);
     }
 
-    // UNCALIBRATED
+    /* UNCALIBRATED. apply() keeps the peaks up to date until one of them leaves the window.
+    ** Only then does this scan the history, at most once per sample, however many ask */
     void getPeaks(AcquiredVolts_t& f, AcquiredVolts_t& r)
     {
-        f = r = 0;
-        for (int i = 0; i < NUM_TO_AVERAGE; i++)
+        if (!peaksValid)
+        {
+            peakF = peakR = 0;
+            peakFIndex = peakRIndex = 0;
+            for (int i = 0; i < NUM_TO_AVERAGE; i++)
+            {
+                AcquiredVolts_t v = history[i].fwdVolts();
+                if (v > peakF)
+                {
+                    peakF = v;
+                    peakFIndex = i;
+                }
+                v = history[i].revVolts();
+                if (v > peakR)
+                {
+                    peakR = v;
+                    peakRIndex = i;
+                }
+            }
+            peaksValid = true;
+        }
+        f = peakF;
+        r = peakR;
+    }
+
+    // samples between the one at history index i and the newest. 0 is the newest
+    uint16_t ageOf(int i)
+    {
+        int age = curIndex - 1 - i;
+        return age < 0 ? age + NUM_TO_AVERAGE : age;
+    }
+
+    // age of the highest reflected sample among the newest n. 0 if they are all zero
+    uint16_t peakRAge(uint16_t n)
+    {
+        if (n > NUM_TO_AVERAGE)
+            n = NUM_TO_AVERAGE;
+        AcquiredVolts_t peak = 0;
+        uint16_t ret = 0;
+        int i = curIndex;
+        for (uint16_t age = 0; age < n; age++)
         {
-            if (fwdHistory[i] > f)
-                f = fwdHistory[i];
-            if (revHistory[i] > r)
-                r = revHistory[i];
+            if (--i < 0)
+                i = NUM_TO_AVERAGE - 1;
+            AcquiredVolts_t v = history[i].revVolts();
+            if (v != 0 && v >= peak)
+            {   // the oldest of equals, where the fault started
+                peak = v;
+                ret = age;
+            }
+        }
+        return ret;
+    }
+}
+
+namespace window {
+    static_assert(NUM_USERS == WINDOW_USERS, "EEPROM_WINDOWS layout");
+    const uint8_t BLOCK_SAMPLES = 40; // 5 << 3. See endBlock()
+    const uint8_t NUM_STAGES = 2; // the exponential windows, from WIN_SECONDS
+    const uint8_t STAGE_PWR[NUM_STAGES] = {6, 10}; // time constants of 1 << STAGE_PWR blocks
+    const uint16_t WINDOW_MSEC[NUM_WINDOWS] = {60, 480, 3840, 61440};
+    const char USER_LETTERS[NUM_USERS + 1] = "MKAP";
+
+    struct Direction
+    {
+        uint64_t sum; // squares of this block's samples so far
+        AcquiredVolts_t peak; // this block's so far
+        uint32_t blockMean; // of the last complete block
+        AcquiredVolts_t blockPeak;
+        uint32_t stageMean[NUM_STAGES];
+        AcquiredVolts_t stagePeak[NUM_STAGES];
+    };
+    Direction fwd;
+    Direction rev;
+    uint8_t count; // samples in this block so far
+    uint8_t Windows[NUM_USERS];
+
+    void SetFromEEPROM()
+    {
+        for (uint8_t i = 0; i < NUM_USERS; i++)
+        {
+            uint8_t w = EEPROM.read((int)EEPROM_WINDOWS + i);
+            Windows[i] = w < NUM_WINDOWS ? w : static_cast<uint8_t>(WIN_HISTORY);
+        }
+    }
+
+    void Set(char user, uint8_t w)
+    {
+        const char *p = strchr(USER_LETTERS, user);
+        if (p == 0 || user == 0 || w >= NUM_WINDOWS)
+            return;
+        EEPROM.update((int)EEPROM_WINDOWS + (p - USER_LETTERS), w);
+        SetFromEEPROM();
+        meterUpdate::Pending = true;
+    }
+
+    void Print()
+    {
+        Serial.print(F("WIN"));
+        for (uint8_t i = 0; i < NUM_USERS; i++)
+        {
+            Serial.print(' ');
+            Serial.print(USER_LETTERS[i]);
+            Serial.print('=');
+            Serial.print(Windows[i]);
+        }
+        Serial.print(F(" msec"));
+        for (uint8_t w = 0; w < NUM_WINDOWS; w++)
+        {
+            Serial.print(' ');
+            Serial.print(w);
+            Serial.print(':');
+            Serial.print(WINDOW_MSEC[w]);
+        }
+        Serial.println();
+    }
+
+    void clear()
+    {
+        memset(&fwd, 0, sizeof(fwd));
+        memset(&rev, 0, sizeof(rev));
+        count = 0;
+    }
+
+    // true if the stages changed
+    bool endBlock(Direction &d)
+    {   // 40 of the largest AcquiredVolts_t, squared, shifted down by 3, fit in 32 bits
+        d.blockMean = static_cast<uint32_t>(d.sum >> 3) / 5;
+        d.blockPeak = d.peak;
+        d.sum = 0;
+        d.peak = 0;
+        bool changed = false;
+        for (uint8_t i = 0; i < NUM_STAGES; i++)
+        {   /* The shift floors, so a falling mean gets all the way down to the block's,
+            ** and to zero with no RF. A rising one stops short by less than 1 << STAGE_PWR */
+            int32_t diff = static_cast<int32_t>(d.blockMean) - static_cast<int32_t>(d.stageMean[i]);
+            uint32_t mean = d.stageMean[i] + (diff >> STAGE_PWR[i]);
+            AcquiredVolts_t peak = d.stagePeak[i];
+            peak -= (peak + (1 << STAGE_PWR[i]) - 1) >> STAGE_PWR[i]; // at least 1 while nonzero
+            if (d.blockPeak > peak)
+                peak = d.blockPeak;
+            changed = changed || mean != d.stageMean[i] || peak != d.stagePeak[i];
+            d.stageMean[i] = mean;
+            d.stagePeak[i] = peak;
+        }
+        return changed;
+    }
+
+    void add(Direction &d, AcquiredVolts_t v)
+    {
+        d.sum += static_cast<uint32_t>(v) * v;
+        if (v > d.peak)
+            d.peak = v;
+    }
+
+    void apply(AcquiredVolts_t f, AcquiredVolts_t r)
+    {
+        add(fwd, f);
+        add(rev, r);
+        if (++count < BLOCK_SAMPLES)
+            return;
+        count = 0;
+        bool changed = endBlock(fwd);
+        changed = endBlock(rev) || changed;
+        if (changed)
+            meterUpdate::Epoch += 1; // the display has something new, even with the history unchanged
+    }
+
+    DisplayPower_t pwr(User_t u, const Direction &d, bool forward)
+    {
+        switch (Windows[u])
+        {
+        case WIN_BLOCK:
+            return d.blockMean;
+        case WIN_SECONDS:
+        case WIN_MINUTE:
+            return d.stageMean[Windows[u] - WIN_SECONDS];
+        default:
+            return forward ? movingAverage::fwdPwr() : movingAverage::revPwr();
+        }
+    }
+
+    DisplayPower_t fwdPwr(User_t u)
+    {
+        return pwr(u, fwd, true);
+    }
+
+    DisplayPower_t revPwr(User_t u)
+    {
+        return pwr(u, rev, false);
+    }
+
+    void getPeaks(User_t u, AcquiredVolts_t& f, AcquiredVolts_t& r)
+    {
+        switch (Windows[u])
+        {
+        case WIN_BLOCK:
+            f = fwd.blockPeak;
+            r = rev.blockPeak;
+            break;
+        case WIN_SECONDS:
+        case WIN_MINUTE:
+            f = fwd.stagePeak[Windows[u] - WIN_SECONDS];
+            r = rev.stagePeak[Windows[u] - WIN_SECONDS];
+            break;
+        default:
+            movingAverage::getPeaks(f, r);
+            break;
+        }
+    }
+}
+
+namespace diode {
+    // Corrections to SchottkeyBarrier, in AcquiredVolts_t, indexed by undivided ADC count
+    const int FINE_STEP_PWR = 2; // entries every 4 ADC counts...
+    const int FINE_ENTRIES = 16;
+    const int FINE_COUNT = FINE_ENTRIES << FINE_STEP_PWR; // ...up to 64 counts
+    const int COARSE_STEP_PWR = 4; // then every 16 counts
+    const int LINEAR_COUNT = FINE_COUNT + ((DIODE_TABLE_ENTRIES - FINE_ENTRIES) << COARSE_STEP_PWR);
+    static_assert(LINEAR_COUNT == 320, "diode table coverage");
+
+    int8_t fwdTable[DIODE_TABLE_ENTRIES];
+    int8_t revTable[DIODE_TABLE_ENTRIES];
+
+    inline uint8_t entryFor(uint16_t adc)
+    {
+        if (adc < FINE_COUNT)
+            return adc >> FINE_STEP_PWR;
+        return FINE_ENTRIES + ((adc - FINE_COUNT) >> COARSE_STEP_PWR);
+    }
+
+    // adc is a reading from an undivided input
+    inline AcquiredVolts_t toVolts(uint16_t adc, const int8_t *table)
+    {
+        if (adc == 0)
+            return 0;
+        int16_t v = adc * VOLTS_UNDIVIDED_MULTIPLER + SchottkeyBarrier;
+        if (adc < LINEAR_COUNT)
+        {
+            v += table[entryFor(adc)];
+            if (v < 1)
+                v = 1; // a nonzero reading stays nonzero
+        }
+        return static_cast<AcquiredVolts_t>(v);
+    }
+
+    AcquiredVolts_t Volts(uint16_t adc, bool divided, bool fwd)
+    {
+        if (!divided)
+            return toVolts(adc, fwd ? fwdTable : revTable);
+        // the coupler has schottkey barrier diodes, which limit to about 380mV
+        if (adc == 0)
+            return 0;
+        return adc * VOLTS_LOW_MULTIPLIER + SchottkeyBarrier;
+    }
+
+    void SetTablesFromEEPROM()
+    {
+        bool valid = EEPROM.read((int)EEPROM_DIODE_VALID) == EEPROM_VALID;
+        for (uint8_t i = 0; i < DIODE_TABLE_ENTRIES; i++)
+        {
+            fwdTable[i] = valid ? static_cast<int8_t>(EEPROM.read((int)EEPROM_DIODE_FWD + i)) : 0;
+            revTable[i] = valid ? static_cast<int8_t>(EEPROM.read((int)EEPROM_DIODE_REV + i)) : 0;
+        }
+        movingAverage::clear(); // its totals are of the history's volts under the old tables
+    }
+
+    void SetEntry(bool fwd, uint8_t i, int8_t v)
+    {
+        if (i >= DIODE_TABLE_ENTRIES)
+            return;
+        if (EEPROM.read((int)EEPROM_DIODE_VALID) != EEPROM_VALID)
+        {   // first entry written. the others start at zero
+            for (uint8_t j = 0; j < DIODE_TABLE_ENTRIES; j++)
+            {
+                EEPROM.update((int)EEPROM_DIODE_FWD + j, 0);
+                EEPROM.update((int)EEPROM_DIODE_REV + j, 0);
+            }
+            EEPROM.write((int)EEPROM_DIODE_VALID, EEPROM_VALID);
+        }
+        EEPROM.update((int)(fwd ? EEPROM_DIODE_FWD : EEPROM_DIODE_REV) + i, static_cast<uint8_t>(v));
+        SetTablesFromEEPROM();
+    }
+
+    void Clear()
+    {
+        EEPROM.write((int)EEPROM_DIODE_VALID, 0xff);
+        SetTablesFromEEPROM();
+    }
+
+    void Dump()
+    {
+        for (uint8_t i = 0; i < DIODE_TABLE_ENTRIES; i++)
+        {
+            Serial.print(F("LIN "));
+            Serial.print(i);
+            Serial.print(F(" adc="));
+            Serial.print(i < FINE_ENTRIES ? i << FINE_STEP_PWR : FINE_COUNT + ((i - FINE_ENTRIES) << COARSE_STEP_PWR));
+            Serial.print(F(" F="));
+            Serial.print(fwdTable[i]);
+            Serial.print(F(" R="));
+            Serial.println(revTable[i]);
         }
     }
 }
@@ -1430,7 +2405,7 @@ namespace SwrMeter {
 namespace {
     class MeterFilter {
     public:
-        MeterFilter() : value(0) {}
+        MeterFilter() : value(0), written(-1) {}
         int apply(int s)
         {
             int ret = s + value;
@@ -1440,16 +2415,27 @@ namespace {
             if (ret == value) // sample didn't change filter value? use s
                 ret = s;
             value = ret;
+            if (ret != s)
+                meterUpdate::Pending = true; // not there yet
             return ret;
         }
+        // apply, and analogWrite the result if the pin doesn't already have it
+        void write(int pin, int s)
+        {
+            int v = apply(s);
+            if (v != written || meterUpdate::Rewrite)
+                analogWrite(pin, v);
+            written = v;
+        }
     private:
         int value;
+        int written;
     };
 
     AcquiredVolts_t fwdHires;
     AcquiredVolts_t revHires;
 
-    void sample()
+    bool sample()
     {
         /* SWR should be calculated with coincident FWD and REV measurements.
          * But we have to digitize them serially. There will always be at least
@@ -1457,36 +2443,29 @@ namespace {
          * always be the larger, so read it first, and in the HIGH sensitivity.*/
 
         // start with the Undivided ADC input
-        fwdHires = analogRead(ForwardPwrAnalogUndividedPinIn); // 100 usec
-        if (fwdHires <= AdcMinNonzero)
-            fwdHires = 0;
-        if (fwdHires >= MAXED_ADC)
+        uint16_t fwd = analogRead(ForwardPwrAnalogUndividedPinIn); // 100 usec
+        uint16_t rev;
+        if (fwd <= AdcMinNonzero)
+            fwd = 0;
+        bool divided = fwd >= MAXED_ADC;
+        if (divided)
         {   // undivided voltage at ADC is above 5V, so use the divided ones
-            fwdHires = analogRead(ForwardPwrAnalogLowPinIn); // 100 usec
-            if (fwdHires <= AdcMinNonzero)
-                fwdHires = 0;
-            revHires = analogRead(ReversePwrAnalogLowPinIn); // 100 usec
-            if (revHires <= AdcMinNonzero)
-                revHires = 0;
-            fwdHires *= VOLTS_LOW_MULTIPLIER;
-            revHires *= VOLTS_LOW_MULTIPLIER;
+            fwd = analogRead(ForwardPwrAnalogLowPinIn); // 100 usec
+            if (fwd <= AdcMinNonzero)
+                fwd = 0;
+            rev = analogRead(ReversePwrAnalogLowPinIn); // 100 usec
         }
         else
-        {
-            revHires = analogRead(ReversePwrAnalogUndividedPinIn); // 100 usec
-            if (revHires <= AdcMinNonzero)
-                revHires = 0;
-            fwdHires *= VOLTS_UNDIVIDED_MULTIPLER;
-            revHires *= VOLTS_UNDIVIDED_MULTIPLER;
-        }
-
-        // the coupler has schottkey barrier diodes, which limit to about 380mV
-        if (fwdHires > 0)
-            fwdHires += SchottkeyBarrier;
-        if (revHires > 0)
-            revHires += SchottkeyBarrier;
-
-        movingAverage::apply(fwdHires, revHires);
+            rev = analogRead(ReversePwrAnalogUndividedPinIn); // 100 usec
+        if (rev <= AdcMinNonzero)
+            rev = 0;
+
+        // at low drive, on the undivided inputs, the barrier is looked up by ADC count
+        fwdHires = diode::Volts(fwd, divided, true);
+        revHires = diode::Volts(rev, divided, false);
+        movingAverage::apply(movingAverage::Pair_t::pack(fwd, rev, divided), fwdHires, revHires);
+        recorder::Sample(fwdHires, revHires);
+        return (fwdHires != 0) || (revHires != 0);
     }
 
     template <int PWRENTRIES>
@@ -1498,14 +2477,14 @@ namespace {
              * binary search the table who's contents are in program memory
              */
         public:
-            FLASH(const uint16_t* pgm) : addr((uint16_t)pgm) {}
+            FLASH(const uint16_t* pgm) : addr(pgm) {}
             FLASH(const FLASH& other) : addr(other.addr) {}
             uint16_t operator[] (int i) const
             {
-                return pgm_read_word_near(addr + i * sizeof(uint16_t));
+                return pgm_read_word_near(addr + i);
             }
         private:
-            uint16_t addr;
+            const uint16_t *addr; // 16 bits on the AVR, same as before
         };
         static unsigned map(unsigned i) { return i << (PWM_MAX_PWR - PWRENTRIES); }
         static unsigned TableLookup(uint16_t value, FLASH table)
@@ -1539,22 +2518,24 @@ namespace {
         }
     };
 
-    uint8_t SwrToMeter(uint16_t swrCoded)
+    uint8_t SwrToPwm(uint16_t swrCoded)
     {
         uint16_t v = MeterInvert<SwrMeter::PWR_ENTRIES>::TableLookup(swrCoded, SwrMeter::PwmToSwr);
-        v = MeterInvert<SwrMeter::PWR_ENTRIES>::map(v);
+        return (uint8_t)MeterInvert<SwrMeter::PWR_ENTRIES>::map(v);
+    }
+
+    uint8_t SwrToMeter(uint16_t swrCoded)
+    {
+        uint8_t v = SwrToPwm(swrCoded);
         static MeterFilter meterFilter; // don't jerk the meter around too quickly
-        analogWrite(SwrMeterPinOut, meterFilter.apply(v));
-        return (uint8_t)v;
+        meterFilter.write(SwrMeterPinOut, v);
+        return v;
     }
 
-    uint8_t DisplaySwr()
+    // f and r are calibrated volts. Returns SWR * SWR_SCALE, or 1 if f is zero
+    uint16_t SwrCoded(uint32_t f, uint32_t r)
     {
-        static movingAverage::AvgSinceLastCheck average;
         unsigned long displayValue = 1;
-        uint32_t f;
-        uint32_t r;
-        average.getCalibratedSums(f, r);
         if (f)
         {
             if (r < f)
@@ -1576,7 +2557,18 @@ namespace {
             else
                 displayValue = INFINITE_SWR << SWR_SCALE_PWR;
         }
-        return SwrToMeter(static_cast<uint16_t>(displayValue));
+        return static_cast<uint16_t>(displayValue);
+    }
+
+    uint8_t DisplaySwr()
+    {   /* one update's samples. meterUpdate can skip this for seconds, and the samples
+        ** from before the skip are not wanted */
+        static movingAverage::AvgSinceLastCheck average;
+        uint32_t f;
+        uint32_t r;
+        average.getCalibratedSums(f, r, MeterUpdateSamples);
+        movingAverage::getSwrSums(movingAverage::SWR_FOR_METER, f, r);
+        return SwrToMeter(SwrCoded(f, r));
     }
 
     bool FrontPanelLamps()
@@ -1592,6 +2584,17 @@ namespace {
             return false;
     }
 
+    uint8_t SwitchBits()
+    {
+        uint8_t ret = digitalRead(PeakSwitchPinIn) == LOW ? 1 :
+            digitalRead(AverageSwitchPinIn) == LOW ? 2 : 0;
+        if (BackPanelPwrSwitchFwd)
+            ret |= 4;
+        if (BackPanelAloSwitchSwr)
+            ret |= 8;
+        return ret;
+    }
+
     DisplayPower_t SquareToWatts(DisplayPower_t s)
     {
         uint64_t ret = s;
@@ -1611,7 +2614,7 @@ namespace {
     {
         AcquiredVolts_t f;
         AcquiredVolts_t r;
-        movingAverage::getPeaks(f, r);
+        window::getPeaks(window::METER_PEAK, f, r);
         DisplayPower_t ret = VoltsToWatts(BackPanelPwrSwitchFwd ? calibrateFwd(f) : calibrateRev(r));
         static DisplayPower_t prev;
         bool sample = ret != 0;
@@ -1628,7 +2631,7 @@ namespace {
         // calculate the peak
         AcquiredVolts_t f;
         AcquiredVolts_t r;
-        movingAverage::getPeaks(f, r);
+        window::getPeaks(window::METER_PEAK, f, r);
         DisplayPower_t ret = VoltsToWatts(BackPanelPwrSwitchFwd ? calibrateFwd(f) : calibrateRev(r));
 
         static DisplayPower_t peakHold;
@@ -1645,6 +2648,8 @@ namespace {
             leds.SetSampleLed(false);
             ret = peakHold;
         }
+        if (peakHold != 0)
+            meterUpdate::Pending = true; // until it times out
         leds.BlinkLed(PowerMeterLeds::FrontPanel::PEAK_SAMPLE, false);
 
         // Read the hold pot
@@ -1660,8 +2665,8 @@ namespace {
         leds.SetSampleLed(false);
         HoldTimePotMsec = 0;
         return SquareToWatts(BackPanelPwrSwitchFwd ?
-            calibrateFwdPower(movingAverage::fwdPwr()) :
-            calibrateRevPower(movingAverage::revPwr()));
+            calibrateFwdPower(window::fwdPwr(window::METER_AVERAGE)) :
+            calibrateRevPower(window::revPwr(window::METER_AVERAGE)));
     }
 
     namespace PwrMeter {
@@ -2217,12 +3222,17 @@ namespace {
 #endif
     }
 
-    void PwrToMeter(uint16_t toDisplay)
+    uint8_t PwrToPwm(uint16_t toDisplay)
     {
         uint16_t m = MeterInvert<PwrMeter::PWR_ENTRIES>::TableLookup(toDisplay, PwrMeter::PwmToPwr);
-        auto v = MeterInvert<PwrMeter::PWR_ENTRIES>::map(m);
+        return (uint8_t)MeterInvert<PwrMeter::PWR_ENTRIES>::map(m);
+    }
+
+    void PwrToMeter(uint16_t toDisplay)
+    {
+        uint8_t v = PwrToPwm(toDisplay);
         static MeterFilter meterFilter;
-        analogWrite(RfMeterPinOut, meterFilter.apply(v));
+        meterFilter.write(RfMeterPinOut, v);
     }
 
     void DisplayPwr(DisplayPower_t v)
@@ -2242,6 +3252,8 @@ namespace {
                 leds.BlinkLed(PowerMeterLeds::FrontPanel::RANGE_LOW, false);
                 leds.SetHighLed(false);
             }
+            else
+                meterUpdate::Pending = true;
             toDisplay = 0;
         }
         else
@@ -2265,7 +3277,10 @@ namespace {
                     leds.SetHighLed(false);
                 }
                 else
+                {
                     toDisplay = v / 10;
+                    meterUpdate::Pending = true;
+                }
             }
             else if (v <= PWR_BREAKTOLOWLOW_POINT)
             {
@@ -2282,6 +3297,8 @@ namespace {
                     leds.SetLowLed(false, true);
                     leds.BlinkLed(PowerMeterLeds::FrontPanel::RANGE_LOW, true);
                 }
+                else
+                    meterUpdate::Pending = true;
             }
             else
             {
@@ -2296,12 +3313,14 @@ namespace {
 }
 
 namespace Alo {
-        void Lockout(DisplayPower_t p)
+        // age is of the sample that caused it, for the flight recorder
+        void Lockout(DisplayPower_t p, uint16_t age)
         {
                 static const uint32_t LockoutThreshold =    25672; // 200W
                 // only turn on SENSE light until foward power exceeds 200W
                 if (p >= LockoutThreshold )
                 {
+                        recorder::Trigger(recorder::TRIG_ALO, age);
                         LockoutStartedAtMillis = millis();
                         leds.SetAloLock(true);
                 }
@@ -2313,10 +3332,12 @@ namespace Alo {
                 if (swr >= aloLimit)
                 {
                         leds.SetSenseLed(true);
+                        meterUpdate::Pending = true; // renew the lock out while it lasts
                         AcquiredVolts_t f;
                         AcquiredVolts_t r;
                         movingAverage::getPeaks(f,r);
-                        Lockout(VoltsToWatts(calibrateFwd(f)));
+                        // the SWR is of the samples DisplaySwr() averaged
+                        Lockout(VoltsToWatts(calibrateFwd(f)), movingAverage::peakRAge(MeterUpdateSamples));
                 }
                 else
                     leds.SetSenseLed(false);
@@ -2332,7 +3353,8 @@ namespace Alo {
                 if (v >= EEPROM.read((int)EEPROM_PWR_LOCK))
                 {
                         leds.SetSenseLed(true);
-                        Lockout(VoltsToWatts(calibrateFwd(f)));
+                        meterUpdate::Pending = true;
+                        Lockout(VoltsToWatts(calibrateFwd(f)), movingAverage::ageOf(movingAverage::peakRIndex));
                 }
                 else
                     leds.SetSenseLed(false);
@@ -2418,15 +3440,200 @@ namespace calibrate {
         return 0;
     }
 
+    struct Fit_t
+    {
+        AcquiredVolts_t gain; // 0x8000 is 1.0
+        int16_t offset;
+        int16_t curve;
+    };
+    static_assert(sizeof(Fit_t) == CAL_FIT_BYTES, "EEPROM_CAL_FWD layout");
+
+    struct Point_t
+    {
+        DisplayPower_t watts; // reference. 0 or 0xFFFFFFFF is no point
+        DisplayPower_t square; // UNCALIBRATED mean square volts
+    };
+    static_assert(sizeof(Point_t) == CAL_POINT_BYTES, "EEPROM_CAL_POINTS layout");
+
+    // power calibration (A) scales the gain by about +/- 5%
+    AcquiredVolts_t trim(AcquiredVolts_t gain, uint8_t eepromByte)
+    {
+        // the factor is 0x8000 less 4240 to plus 4320, so the product can pass INT32_MAX.
+        // Both are positive, and it fits unsigned
+        uint32_t g = static_cast<uint32_t>(gain) *
+            static_cast<uint16_t>(0x8000 + EpromByteToCaliOffset(eepromByte));
+        g >>= 15;
+        return g > 0xFFFF ? 0xFFFF : static_cast<AcquiredVolts_t>(g);
+    }
+
     void SetCalibrationConstantsFromEEPROM()
     {
-        fwdCalibration = 0x8000; // this fixed point 1.0 multiplier
-        revCalibration = 0x8000; // ditto
+        Fit_t fwd = {0x8000, 0, 0}; // this fixed point 1.0 multiplier
+        Fit_t rev = fwd; // ditto
+        if (EEPROM.read((int)EEPROM_CAL_VALID) == EEPROM_VALID)
+        {
+            EEPROM.get((int)EEPROM_CAL_FWD, fwd);
+            EEPROM.get((int)EEPROM_CAL_REV, rev);
+        }
+        fwdCalibration = trim(fwd.gain, EEPROM.read((int)EEPROM_FWD_CALIBRATION));
+        revCalibration = trim(rev.gain, EEPROM.read((int)EEPROM_REFL_CALIBRATION));
+        fwdCalOffset = fwd.offset;
+        fwdCalCurve = fwd.curve;
+        revCalOffset = rev.offset;
+        revCalCurve = rev.curve;
+        calibrateGainOnly = fwd.offset == 0 && fwd.curve == 0 && rev.offset == 0 && rev.curve == 0;
+    }
+
+    // term is G, O or C. direction is F or R
+    void SetFit(char term, char direction, long v)
+    {
+        if (direction != 'F' && direction != 'R')
+            return;
+        if (EEPROM.read((int)EEPROM_CAL_VALID) != EEPROM_VALID)
+        {   // first term written. the others start at nominal
+            const Fit_t nominal = {0x8000, 0, 0};
+            EEPROM.put((int)EEPROM_CAL_FWD, nominal);
+            EEPROM.put((int)EEPROM_CAL_REV, nominal);
+            EEPROM.write((int)EEPROM_CAL_VALID, EEPROM_VALID);
+        }
+        int addr = direction == 'F' ? EEPROM_CAL_FWD : EEPROM_CAL_REV;
+        Fit_t fit;
+        EEPROM.get(addr, fit);
+        if (term == 'G' && v > 0 && v <= 0xFFFF)
+        {
+            fit.gain = static_cast<AcquiredVolts_t>(v);
+            // calibration (A) trims the fit from here
+            EEPROM.write((int)(direction == 'F' ? EEPROM_FWD_CALIBRATION : EEPROM_REFL_CALIBRATION), 0xff);
+        }
+        else if (term == 'O' && v >= -0x8000 && v <= 0x7FFF)
+            fit.offset = static_cast<int16_t>(v);
+        else if (term == 'C' && v >= -0x8000 && v <= 0x7FFF)
+            fit.curve = static_cast<int16_t>(v);
+        else
+            return;
+        EEPROM.put(addr, fit);
+        SetCalibrationConstantsFromEEPROM();
+    }
+
+    const uint8_t CaptureUpdates = 16; // of MeterUpdateIntervalMsec. 2 seconds
+    const uint8_t NOT_CAPTURING = 0xff;
+    uint8_t capturePoint = NOT_CAPTURING;
+    uint8_t captureCount;
+    DisplayPower_t captureWatts;
+    uint32_t captureF; // sums of mean squares, each divided by CaptureUpdates
+    uint32_t captureR;
+
+    void PrintPoint(uint8_t n, const Point_t &p)
+    {
+        bool reflected = (EEPROM.read((int)EEPROM_CAL_REFLECTED) & (1 << n)) != 0;
+        Serial.print(F("CAL "));
+        Serial.print(n);
+        Serial.print(F(" W:"));
+        Serial.print(p.watts);
+        Serial.print(reflected ? F(" R:") : F(" F:"));
+        Serial.print(p.square);
+        Serial.print(F(" N:"));
+        Serial.println(SquareToWatts(p.square));
+    }
+
+    // watts, with an optional fraction, to DisplayPower_t
+    DisplayPower_t parseWatts(const char *p)
+    {
+        DisplayPower_t w = static_cast<DisplayPower_t>(atol(p)) << PWR_SCALE_PWR;
+        const char *dot = strchr(p, '.');
+        if (dot != 0)
+        {
+            DisplayPower_t frac = 0;
+            DisplayPower_t denom = 1;
+            for (const char *q = dot + 1; isdigit(*q) && denom < 10000; q++)
+            {
+                frac = frac * 10 + (*q - '0');
+                denom *= 10;
+            }
+            w += ((frac << PWR_SCALE_PWR) + denom / 2) / denom;
+        }
+        return w;
+    }
+
+    void StartCapture(uint8_t n, const char *watts)
+    {
+        if (n >= CAL_POINTS)
+            return;
+        DisplayPower_t w = parseWatts(watts);
+        if (w == 0)
+        {   // erase
+            const Point_t none = {0, 0};
+            EEPROM.put((int)EEPROM_CAL_POINTS + n * CAL_POINT_BYTES, none);
+            PrintPoint(n, none);
+            return;
+        }
+        capturePoint = n;
+        captureWatts = w;
+        captureCount = 0;
+        captureF = 0;
+        captureR = 0;
+    }
+
+    void CaptureUpdate()
+    {
+        if (capturePoint == NOT_CAPTURING)
+            return;
+        captureF += movingAverage::fwdPwr() / CaptureUpdates;
+        captureR += movingAverage::revPwr() / CaptureUpdates;
+        if (++captureCount < CaptureUpdates)
+            return;
+        uint8_t n = capturePoint;
+        capturePoint = NOT_CAPTURING;
+        if (captureF == 0 && captureR == 0)
+        {
+            Serial.print(F("CAL "));
+            Serial.print(n);
+            Serial.println(F(" no RF"));
+            return;
+        }
+        bool reflected = captureR > captureF;
+        Point_t p;
+        p.watts = captureWatts;
+        p.square = reflected ? captureR : captureF;
+        EEPROM.put((int)EEPROM_CAL_POINTS + n * CAL_POINT_BYTES, p);
+        uint8_t bits = EEPROM.read((int)EEPROM_CAL_REFLECTED);
+        EEPROM.update((int)EEPROM_CAL_REFLECTED, reflected ? bits | (1 << n) : bits & ~(1 << n));
+        PrintPoint(n, p);
+    }
+
+    void PrintFit(bool reflected, AcquiredVolts_t gain, int16_t offset, int16_t curve)
+    {
+        Serial.print(reflected ? F("CALR G:") : F("CALF G:"));
+        Serial.print(gain);
+        Serial.print(F(" O:"));
+        Serial.print(offset);
+        Serial.print(F(" C:"));
+        Serial.println(curve);
+    }
+
+    void Print()
+    {
+        for (uint8_t i = 0; i < CAL_POINTS; i++)
+        {
+            Point_t p;
+            EEPROM.get((int)EEPROM_CAL_POINTS + i * CAL_POINT_BYTES, p);
+            if (p.watts != 0 && p.watts != 0xFFFFFFFFul)
+                PrintPoint(i, p);
+        }
+        PrintFit(false, fwdCalibration, fwdCalOffset, fwdCalCurve);
+        PrintFit(true, revCalibration, revCalOffset, revCalCurve);
+    }
 
-        uint8_t fCal = EEPROM.read((int)EEPROM_FWD_CALIBRATION);
-        fwdCalibration += EpromByteToCaliOffset(fCal);
-        uint8_t reflectedCal = EEPROM.read((int)EEPROM_REFL_CALIBRATION);
-        revCalibration += EpromByteToCaliOffset(reflectedCal);
+    void Clear()
+    {
+        for (uint8_t i = 0; i < CAL_POINTS; i++)
+        {
+            const Point_t none = {0, 0};
+            EEPROM.put((int)EEPROM_CAL_POINTS + i * CAL_POINT_BYTES, none);
+        }
+        EEPROM.write((int)EEPROM_CAL_REFLECTED, 0);
+        EEPROM.write((int)EEPROM_CAL_VALID, 0xff);
+        SetCalibrationConstantsFromEEPROM();
     }
 
     // meter is in calibrate mode, power FOR/REFL settings adjust
@@ -2487,7 +3694,327 @@ namespace calibrate {
     }
 }
 
+namespace recorder {
+    const uint8_t CAPTURE_SAMPLES = 32; // 48 msec of samples
+    const uint8_t CAPTURE_POST = 8; // of those after the trigger
+    const unsigned long RearmMsec = LockoutLengthMsec;
+    const uint8_t DEFAULT_SWR10 = 30; // 3:1
+    const uint8_t FORMAT_VERSION = 2; // of Header_t and what follows it
+    const uint8_t NO_TRIP = 0xff; // Trip_t::cause of an erased record
+
+    struct Trip_t
+    {
+        uint16_t seq; // counts trips since TRIPCLR
+        uint8_t cause; // TRIG_ bits
+        uint8_t swr10; // over the capture, in tenths. 255 is 25.5 or worse
+        AcquiredVolts_t peakF; // highest in the capture, uncalibrated
+        AcquiredVolts_t peakR;
+    };
+    static_assert(sizeof(Trip_t) == TRIP_RECORD_BYTES, "EEPROM_TRIPS layout");
+
+    struct Header_t
+    {
+        uint8_t version; // FORMAT_VERSION
+        uint8_t samples; // CAPTURE_SAMPLES
+        uint8_t post; // samples after the trigger. CAPTURE_POST, unless the trigger was near the end of the history
+        uint8_t cause; // of the capture. 0 if there hasn't been one
+        uint16_t seq; // of the capture's trip
+        uint16_t sampleMicros; // TimerLoopIntervalMicroSec
+        uint16_t eepromBytes; // EEPROM_USED
+    };
+    static_assert(sizeof(Header_t) == 10, "RECGET layout");
+
+    uint8_t Triggers = TRIG_ALO;
+    uint8_t Swr10 = DEFAULT_SWR10;
+    AcquiredVolts_t PwrVolts; // forward volts at the TRIG_PWR threshold
+    AcquiredVolts_t MinVolts; // forward volts at PowerMinToDisplay
+    bool Armed = true;
+    bool Seen; // some trigger condition held since the last Update()
+    unsigned long LastSeenMillis;
+    uint8_t PostCount; // samples still to come after the trigger
+    uint8_t Post = CAPTURE_POST; // in the capture, after its trigger
+    uint8_t Cause; // of the capture in progress
+    bool TripPending; // Trip is waiting to be written to EEPROM
+    Trip_t Trip; // the capture's
+    movingAverage::Pair_t Capture[CAPTURE_SAMPLES]; // oldest first
+
+    // the uncalibrated forward volts that VoltsToWatts shows as p
+    AcquiredVolts_t WattsToVolts(DisplayPower_t p)
+    {   // v * v = p * NominalCouplerResistanceMultiplier / NominalCouplerResistanceRecip, in 32 bits
+        static_assert(NominalCouplerResistanceMultiplier == 1ul << 17, "WattsToVolts");
+        uint32_t sq = (p << 8) / NominalCouplerResistanceRecip;
+        if (sq >= 1ul << 23)
+            return 0xFFFF; // out of range of the ADC anyway
+        return rootOf(sq << 9);
+    }
+
+    void SetTriggersFromEEPROM()
+    {
+        uint8_t t = EEPROM.read((int)EEPROM_TRIG_MASK);
+        Triggers = t == 0xff ? static_cast<uint8_t>(TRIG_ALO) : t;
+        uint8_t s = EEPROM.read((int)EEPROM_TRIG_SWR);
+        Swr10 = (s > 10 && s != 0xff) ? s : DEFAULT_SWR10;
+        uint16_t w;
+        EEPROM.get((int)EEPROM_TRIG_PWR, w);
+        PwrVolts = (w == 0 || w == 0xFFFF) ? 0xFFFF : // off
+            WattsToVolts(static_cast<DisplayPower_t>(w) << PWR_SCALE_PWR);
+        MinVolts = WattsToVolts(PowerMinToDisplay);
+    }
+
+    void SetTriggers(const char *letters)
+    {
+        uint8_t t = 0;
+        for (; *letters; letters++)
+        {
+            if (*letters == 'A')
+                t |= TRIG_ALO;
+            else if (*letters == 'S')
+                t |= TRIG_SWR;
+            else if (*letters == 'P')
+                t |= TRIG_PWR;
+        }
+        EEPROM.update((int)EEPROM_TRIG_MASK, t);
+        SetTriggersFromEEPROM();
+    }
+
+    // s as in 3 or 3.5
+    void SetSwr(const char *s)
+    {
+        int tenths = atoi(s) * 10;
+        const char *dot = strchr(s, '.');
+        if (dot != 0 && isdigit(dot[1]))
+            tenths += dot[1] - '0';
+        if (tenths > 10 && tenths < 0xff)
+        {
+            EEPROM.update((int)EEPROM_TRIG_SWR, static_cast<uint8_t>(tenths));
+            SetTriggersFromEEPROM();
+        }
+    }
+
+    void SetPwr(uint16_t watts)
+    {
+        EEPROM.put((int)EEPROM_TRIG_PWR, watts);
+        SetTriggersFromEEPROM();
+    }
+
+    void PrintCause(uint8_t cause)
+    {
+        if (cause & TRIG_ALO)
+            Serial.print('A');
+        if (cause & TRIG_SWR)
+            Serial.print('S');
+        if (cause & TRIG_PWR)
+            Serial.print('P');
+    }
+
+    void PrintSwr10(uint8_t swr10)
+    {
+        Serial.print(swr10 / 10);
+        Serial.print('.');
+        Serial.print(swr10 % 10);
+    }
+
+    void PrintTriggers()
+    {
+        Serial.print(F("TRIG="));
+        PrintCause(Triggers);
+        Serial.print(F(" SWR="));
+        PrintSwr10(Swr10);
+        uint16_t w;
+        EEPROM.get((int)EEPROM_TRIG_PWR, w);
+        Serial.print(F(" PWR="));
+        Serial.println(w == 0xFFFF ? 0 : w); // 0 is off
+    }
+
+    void Freeze(uint16_t endAge, uint8_t post);
+
+    void Trigger(uint8_t cause, uint16_t age)
+    {
+        cause &= Triggers;
+        if (cause == 0)
+            return;
+        Seen = true;
+        if (!Armed)
+            return;
+        Armed = false;
+        Cause = cause;
+        if (age < CAPTURE_POST)
+        {   // Sample() freezes once the rest are in
+            PostCount = CAPTURE_POST - age;
+            return;
+        }
+        // the samples after it are in the history already
+        using movingAverage::NUM_TO_AVERAGE;
+        uint16_t endAge = age - CAPTURE_POST;
+        if (endAge > NUM_TO_AVERAGE - CAPTURE_SAMPLES)
+            endAge = NUM_TO_AVERAGE - CAPTURE_SAMPLES; // so near the oldest, the capture starts there
+        Freeze(endAge, static_cast<uint8_t>(age - endAge));
+    }
+
+    /* copy the capture out of the history before it is overwritten, and summarize it.
+    ** Its newest sample is endAge before the newest in the history, and its trigger is post before that */
+    void Freeze(uint16_t endAge, uint8_t post)
+    {
+        using namespace movingAverage;
+        int i = curIndex - CAPTURE_SAMPLES - static_cast<int>(endAge);
+        if (i < 0)
+            i += NUM_TO_AVERAGE;
+        Post = post;
+        uint32_t f = 0;
+        uint32_t r = 0;
+        Trip.peakF = 0;
+        Trip.peakR = 0;
+        for (uint8_t j = 0; j < CAPTURE_SAMPLES; j++)
+        {
+            Capture[j] = history[i];
+            AcquiredVolts_t cf = Capture[j].fwdVolts();
+            AcquiredVolts_t cr = Capture[j].revVolts();
+            f += cf;
+            r += cr;
+            if (cf > Trip.peakF)
+                Trip.peakF = cf;
+            if (cr > Trip.peakR)
+                Trip.peakR = cr;
+            if (++i >= NUM_TO_AVERAGE)
+                i = 0;
+        }
+        calibrateSums(f, r, CAPTURE_SAMPLES);
+        uint32_t swr10 = (static_cast<uint32_t>(SwrCoded(f, r)) * 10 + SWR_SCALE / 2) >> SWR_SCALE_PWR;
+        Trip.swr10 = f == 0 ? 0 : swr10 > 0xff ? 0xff : static_cast<uint8_t>(swr10);
+        Trip.cause = Cause;
+        TripPending = true;
+    }
+
+    void Sample(AcquiredVolts_t f, AcquiredVolts_t r)
+    {
+        if (PostCount != 0)
+        {
+            if (--PostCount == 0)
+                Freeze(0, CAPTURE_POST);
+            return;
+        }
+        uint8_t cause = 0;
+        if ((Triggers & TRIG_PWR) && f >= PwrVolts)
+            cause |= TRIG_PWR;
+        // SWR >= s is r * (s + 1) >= f * (s - 1)
+        if ((Triggers & TRIG_SWR) && f >= MinVolts && f != 0 &&
+            static_cast<uint32_t>(r) * (Swr10 + 10) >= static_cast<uint32_t>(f) * (Swr10 - 10))
+            cause |= TRIG_SWR;
+        if (cause != 0)
+            Trigger(cause);
+    }
+
+    void Update(unsigned long now)
+    {
+        if (Seen)
+        {
+            Seen = false;
+            LastSeenMillis = now;
+        }
+        if (TripPending)
+        {   // about 30 msec of EEPROM writes, after the capture, not during it
+            TripPending = false;
+            uint16_t seq;
+            EEPROM.get((int)EEPROM_TRIP_NEXT, seq);
+            if (seq == 0xFFFF)
+                seq = 0; // erased
+            Trip.seq = seq;
+            EEPROM.put((int)EEPROM_TRIPS + (seq % TRIP_RECORDS) * TRIP_RECORD_BYTES, Trip);
+            seq += 1;
+            EEPROM.put((int)EEPROM_TRIP_NEXT, seq);
+        }
+        if (!Armed && PostCount == 0 && now - LastSeenMillis > RearmMsec)
+            Armed = true;
+    }
+
+    void PrintTrips()
+    {
+        uint16_t next;
+        EEPROM.get((int)EEPROM_TRIP_NEXT, next);
+        if (next == 0xFFFF)
+            next = 0;
+        for (uint8_t i = 0; i < TRIP_RECORDS; i++)
+        {   // oldest first
+            Trip_t t;
+            EEPROM.get((int)EEPROM_TRIPS + ((next + i) % TRIP_RECORDS) * TRIP_RECORD_BYTES, t);
+            if (t.cause == NO_TRIP || t.cause == 0)
+                continue;
+            Serial.print(F("TRIP "));
+            Serial.print(t.seq);
+            Serial.print(' ');
+            PrintCause(t.cause);
+            Serial.print(F(" SWR="));
+            PrintSwr10(t.swr10);
+            Serial.print(F(" F:"));
+            Serial.print(t.peakF);
+            Serial.print(F(" R:"));
+            Serial.println(t.peakR);
+        }
+        Serial.print(F("TRIPS="));
+        Serial.println(next);
+    }
+
+    void ClearTrips()
+    {
+        for (int i = 0; i < TRIP_RECORDS * TRIP_RECORD_BYTES; i++)
+            EEPROM.update((int)EEPROM_TRIPS + i, 0xff);
+        const uint16_t zero = 0;
+        EEPROM.put((int)EEPROM_TRIP_NEXT, zero);
+        PrintTrips();
+    }
+
+    // Fletcher-16 of what has been sent
+    struct Sender
+    {
+        uint16_t sum1 = 0;
+        uint16_t sum2 = 0;
+        void send(uint8_t b)
+        {
+            Serial.write(b);
+            sum1 = (sum1 + b) % 255;
+            sum2 = (sum2 + sum1) % 255;
+        }
+        void send(const void *p, uint16_t n)
+        {
+            for (const uint8_t *q = static_cast<const uint8_t *>(p); n != 0; n--)
+                send(*q++);
+        }
+    };
+
+    void Download()
+    {
+        Header_t h;
+        h.version = FORMAT_VERSION;
+        h.samples = CAPTURE_SAMPLES;
+        h.post = Post;
+        h.cause = Trip.cause;
+        h.seq = Trip.seq;
+        h.sampleMicros = TimerLoopIntervalMicroSec;
+        h.eepromBytes = EEPROM_USED;
+        const uint16_t n = sizeof(h) + sizeof(Capture) + EEPROM_USED + 2;
+        Serial.print(F("BIN "));
+        Serial.print(n);
+        Serial.write('\n'); // LF alone. The binary follows
+        Sender s;
+        s.send(&h, sizeof(h));
+        s.send(Capture, sizeof(Capture));
+        for (int i = 0; i < EEPROM_USED; i++)
+            s.send(EEPROM.read(i));
+        uint8_t sum1 = s.sum1;
+        uint8_t sum2 = s.sum2;
+        Serial.write(sum1);
+        Serial.write(sum2);
+    }
+}
+
 namespace sleep {
+    // wake to first nonzero reading measurement
+    enum WakeState_t { AWAKE, WAITING_FOR_READING, LATENCY_MEASURED };
+    WakeState_t WakeState(AWAKE);
+    unsigned long WokeAtMicros;
+    unsigned long WakeLatencyMicros;
+    const unsigned long WakeReadingTimeoutMicros = 1000000;
+
     void Coupler7dot5Interrupt()
     {
         detachInterrupt(digitalPinToInterrupt(couplerPowerDetectPinIn));
@@ -2536,54 +4063,355 @@ namespace sleep {
         power_all_enable();
         sleep_disable();
         sei();
-        Serial.begin(SERIAL_BAUD);
-        Wire.begin();
-        pullUpPins(true);
+        /* The RF that (likely) woke us is a transmission in progress. Get the ADC going before
+        ** anything else. The sample history is from before we slept, and is all zero
+        ** or stale. Start it over rather than seed it with this first sample, which would
+        ** display a full window of that one reading. */
+        WokeAtMicros = micros();
+        WakeState = WAITING_FOR_READING;
         ADCSRA |= (1 << ADEN); // ADC back on
+        movingAverage::clear();
+        if (sample())
+            FirstReading();
+        pullUpPins(true);
+        Serial.begin(SERIAL_BAUD);
+        Wire.begin(); // the LEDs initialize on I2C later. See PowerMeterLeds::wake
 #ifdef SUPPORT_WDT
         wdt_enable(WDTO_1S);
 #endif
     }
+
+    void FirstReading()
+    {
+        if (WakeState == WAITING_FOR_READING)
+        {
+            WakeLatencyMicros = micros() - WokeAtMicros;
+            WakeState = LATENCY_MEASURED;
+        }
+    }
+
+    void ReportWakeLatency()
+    {
+        if (WakeState == LATENCY_MEASURED)
+        {
+            Serial.print(F("Wake to first reading usec="));
+            Serial.println(WakeLatencyMicros);
+            WakeState = AWAKE;
+        }
+        else if ((WakeState == WAITING_FOR_READING) &&
+            (micros() - WokeAtMicros > WakeReadingTimeoutMicros))
+            WakeState = AWAKE; // woke without RF, e.g. the CALI button
+    }
+}
+
+namespace rate {
+    Rate_t Rate(FULL_RATE);
+    unsigned long LastActiveMillis;
+    unsigned long RateStartedMillis;
+    unsigned long MsecAtRate[NUM_RATES];
+
+    void SetRate(Rate_t r, unsigned long now)
+    {
+        MsecAtRate[Rate] += now - RateStartedMillis;
+        RateStartedMillis = now;
+        Rate = r;
+    }
+
+    void Active(unsigned long now)
+    {
+        LastActiveMillis = now;
+        if (Rate != FULL_RATE)
+            SetRate(FULL_RATE, now);
+    }
+
+    void Check(unsigned long now)
+    {
+        if ((Rate == FULL_RATE) && (IdleAfterMsec != 0) && (MeterMode == METER_NORMAL) &&
+            (now - LastActiveMillis > IdleAfterMsec))
+            SetRate(IDLE_RATE, now);
+    }
+
+    void Wait(unsigned long loopStartedMicros)
+    {
+        if (Rate == FULL_RATE)
+        {   // throttle to one loop every TimerLoopIntervalMicroSec
+            long diff = micros() - loopStartedMicros;
+            diff -= TimerLoopIntervalMicroSec;
+            if ((diff < 0) && (diff >= -TimerLoopIntervalMicroSec))
+                delayMicroseconds((unsigned int)-diff);
+            return;
+        }
+        ADCSRA &= ~(1 << ADEN); // ADC off
+        set_sleep_mode(SLEEP_MODE_IDLE);
+        while (micros() - loopStartedMicros < static_cast<unsigned long>(IdleLoopIntervalMicroSec))
+        {
+            if ((digitalRead(couplerPowerDetectPinIn) == LOW) || (Serial.available() > 0))
+                break;
+            sleep_mode(); // the millis() timer interrupt wakes us every msec
+        }
+        ADCSRA |= (1 << ADEN); // ADC back on
+    }
+
+    void Report()
+    {
+        unsigned long now = millis();
+        unsigned long current = now - RateStartedMillis;
+        Serial.print(F("Full rate msec="));
+        Serial.print(MsecAtRate[FULL_RATE] + (Rate == FULL_RATE ? current : 0));
+        Serial.print(F(" Idle rate msec="));
+        Serial.print(MsecAtRate[IDLE_RATE] + (Rate == IDLE_RATE ? current : 0));
+        Serial.print(F(" now="));
+        Serial.println(Rate == FULL_RATE ? F("full") : F("idle"));
+    }
+}
+
+namespace meterUpdate {
+    uint8_t LastEpoch;
+    uint8_t LastSwitches = 0xff; // none such. The first update runs
+
+    bool Due(uint8_t switches)
+    {
+        bool due = Pending || Rewrite || (Epoch != LastEpoch) || (switches != LastSwitches);
+        Pending = false;
+        LastEpoch = Epoch;
+        LastSwitches = switches;
+        if (due)
+            Executed += 1;
+        else
+            Skipped += 1;
+        return due;
+    }
+
+    void Report()
+    {
+        Serial.print(F("Meter updates executed="));
+        Serial.print(Executed);
+        Serial.print(F(" skipped="));
+        Serial.println(Skipped);
+    }
+}
+
+#ifdef __AVR__
+extern "C" uint8_t _end; // from the linker: the first byte past .data and .bss
+extern "C" uint8_t __stack; // RAMEND
+#endif
+
+namespace sram {
+    const uint8_t PAINT = 0xC5;
+
+#ifdef __AVR__
+    /* In .init3, the C runtime has set SP and cleared r1, and has yet to copy .data and clear
+    ** .bss in .init4. There is nothing on the stack. naked: no prologue and no ret, so the
+    ** startup code runs through it into .init4. */
+    void Paint() __attribute__((naked, used, section(".init3")));
+    void Paint()
+    {
+        for (uint8_t *p = &_end; p <= &__stack; p++)
+            *p = PAINT;
+    }
+
+    uint16_t Static()
+    {
+        return &_end - reinterpret_cast<uint8_t *>(RAMSTART);
+    }
+
+    uint16_t NeverUsed()
+    {
+        const uint8_t *p = &_end;
+        while (p <= &__stack && *p == PAINT)
+            p++;
+        return p - &_end;
+    }
+
+    uint16_t FreeNow()
+    {
+        return SP - reinterpret_cast<uint16_t>(&_end);
+    }
+#else // the host build has no linker symbols to measure
+    uint16_t Static() { return 0; }
+    uint16_t NeverUsed() { return 0; }
+    uint16_t FreeNow() { return 0; }
+#endif
+
+    void Report()
+    {
+        Serial.print(F("SRAM static="));
+        Serial.print(Static());
+        Serial.print(F(" headroom="));
+        Serial.print(NeverUsed());
+        Serial.print(F(" free now="));
+        Serial.println(FreeNow());
+    }
 }
 
 namespace Comm {
+        uint8_t Decimation[NUM_STREAMS]; // 0 is not subscribed
+        uint8_t Countdown[NUM_STREAMS];
+        DisplayPower_t holdF; // STREAM_HOLD since it was last sent
+        DisplayPower_t holdR;
+        const char STREAM_LETTERS[NUM_STREAMS + 1] = "APHSLW";
+
+        void Subscribe(char which, uint8_t decimation)
+        {
+            const char *p = strchr(STREAM_LETTERS, which);
+            if (p == 0 || which == 0)
+                return;
+            uint8_t i = p - STREAM_LETTERS;
+            if (Decimation[i] == decimation)
+                return; // a keep alive. Don't restart its countdown, nor lose the hold
+            Decimation[i] = decimation;
+            Countdown[i] = 1; // starting with the next update
+            if (i == STREAM_HOLD)
+                holdF = holdR = 0;
+        }
+
+        void PrintSubscriptions()
+        {
+            Serial.print(F("SUB"));
+            for (uint8_t i = 0; i < NUM_STREAMS; i++)
+            {
+                Serial.print(' ');
+                Serial.print(STREAM_LETTERS[i]);
+                Serial.print('=');
+                Serial.print(Decimation[i]);
+            }
+            Serial.println();
+        }
+
+        void StopOutput()
+        {
+            OutputToSerial = NO_OUTPUT_TO_SERIAL;
+            memset(Decimation, 0, sizeof(Decimation));
+        }
+
+        void printField(const __FlashStringHelper *name, uint32_t v)
+        {
+            Serial.print(name);
+            Serial.print(v);
+        }
+
+        /* Each of the values below is computed at most once per update, however many of
+        ** P ON, P PEAK and the subscriptions want it. */
         void CommUpdateForwardAndReverse()
         {
-            if (OutputToSerial == NO_OUTPUT_TO_SERIAL)
+            uint8_t due = 0; // a bit per Stream_t
+            bool subscribed = false;
+            for (uint8_t i = 0; i < NUM_STREAMS; i++)
+            {
+                if (Decimation[i] == 0)
+                    continue;
+                subscribed = true;
+                if (--Countdown[i] == 0)
+                {
+                    Countdown[i] = Decimation[i];
+                    due |= 1 << i;
+                }
+            }
+            if (OutputToSerial == NO_OUTPUT_TO_SERIAL && !subscribed)
                 return;
+            unsigned long stamp = micros();
+
             static bool printedZero = false;
             static movingAverage::AvgSinceLastCheck average;
-            uint32_t fV;
-            uint32_t rV;
-            average.getCalibratedSums(fV, rV);
-            DisplayPower_t fd(0);
-            DisplayPower_t rd(0);
-            if (Comm::OutputToSerial == Comm::PEAK_OUTPUT_TO_SERIAL)
+            average.accumulate(); // every update, as SUB S=n can be longer apart than the history
+            uint32_t fV = 0;
+            uint32_t rV = 0;
+            uint16_t swr = 1;
+            if (OutputToSerial != NO_OUTPUT_TO_SERIAL || (due & (1 << STREAM_SWR)))
+            {
+                average.getCalibratedSums(fV, rV);
+                uint32_t fS = fV;
+                uint32_t rS = rV;
+                movingAverage::getSwrSums(movingAverage::SWR_FOR_COMM, fS, rS);
+                swr = SwrCoded(fS, rS);
+            }
+            DisplayPower_t fAvg(0);
+            DisplayPower_t rAvg(0);
+            if (OutputToSerial == AVG_OUTPUT_TO_SERIAL || (due & (1 << STREAM_AVERAGE)))
+            {
+                fAvg = SquareToWatts(calibrateFwdPower(window::fwdPwr(window::SERIAL_AVERAGE)));
+                rAvg = SquareToWatts(calibrateRevPower(window::revPwr(window::SERIAL_AVERAGE)));
+            }
+            DisplayPower_t fPeak(0);
+            DisplayPower_t rPeak(0);
+            if (OutputToSerial == PEAK_OUTPUT_TO_SERIAL || Decimation[STREAM_HOLD] != 0 || (due & (1 << STREAM_PEAK)))
             {
                 AcquiredVolts_t f; AcquiredVolts_t r;
-                movingAverage::getPeaks(f, r);
-                fd = VoltsToWatts(calibrateFwd(f));
-                rd = VoltsToWatts(calibrateRev(r));
+                window::getPeaks(window::SERIAL_PEAK, f, r);
+                fPeak = VoltsToWatts(calibrateFwd(f));
+                rPeak = VoltsToWatts(calibrateRev(r));
+                if (fPeak > holdF)
+                    holdF = fPeak;
+                if (rPeak > holdR)
+                    holdR = rPeak;
+            }
+
+            if (OutputToSerial != NO_OUTPUT_TO_SERIAL)
+            {
+                DisplayPower_t fd = OutputToSerial == PEAK_OUTPUT_TO_SERIAL ? fPeak : fAvg;
+                DisplayPower_t rd = OutputToSerial == PEAK_OUTPUT_TO_SERIAL ? rPeak : rAvg;
+                if ((fd > 0) || (rd > 0) || !printedZero)
+                {
+                    // Voltages are always averaged
+                    printField(F("Vf:"), fV);
+                    printField(F(" Vr:"), rV);
+                    //DisplayPower_t is calibrated in units of 1/128 Watt
+                    printField(F(" Pf:"), fd);
+                    printField(F(" Pr:"), rd);
+                    // SWR times SWR_SCALE, per SWRMODE. 1 means no forward power
+                    printField(F(" Sw:"), swr);
+                    // micros() when this record was taken, for the host to line up with its own clock
+                    printField(F(" Tm:"), stamp);
+                    if (leds.GetAloLock())
+                        Serial.print(F(" L"));
+                    Serial.println();
+                }
+                printedZero = (fd == 0) && (rd == 0);
+            }
+
+            if (due == 0)
+                return;
+            if (due & (1 << STREAM_AVERAGE))
+            {
+                printField(F("Fa:"), fAvg);
+                printField(F(" Ra:"), rAvg);
+                Serial.print(' ');
+            }
+            if (due & (1 << STREAM_PEAK))
+            {
+                printField(F("Fp:"), fPeak);
+                printField(F(" Rp:"), rPeak);
+                Serial.print(' ');
+            }
+            if (due & (1 << STREAM_HOLD))
+            {
+                printField(F("Fh:"), holdF);
+                printField(F(" Rh:"), holdR);
+                Serial.print(' ');
+                holdF = holdR = 0;
+            }
+            if (due & (1 << STREAM_SWR))
+            {
+                printField(F("Sw:"), swr);
+                Serial.print(' ');
             }
-            else if (Comm::OutputToSerial == Comm::AVG_OUTPUT_TO_SERIAL)
+            if (due & (1 << STREAM_LOCK))
             {
-                fd = SquareToWatts(calibrateFwdPower(movingAverage::fwdPwr()));
-                rd = SquareToWatts(calibrateRevPower(movingAverage::revPwr()));
+                uint8_t ls = leds.GetAloLock() ? 1 : 0;
+                if (digitalRead(couplerPowerDetectPinIn) == LOW)
+                    ls |= 2;
+                if (digitalRead(PanelLampsPinOut) == HIGH)
+                    ls |= 4;
+                printField(F("Ls:"), ls);
+                Serial.print(' ');
             }
-            if ((fd > 0) || (rd > 0) || !printedZero)
+            if (due & (1 << STREAM_SWITCHES))
             {
-                // Voltages are always averaged
-                Serial.print(F("Vf:")); Serial.print(fV); 
-                Serial.print(F(" Vr:")); Serial.print(rV);
-
-                //DisplayPower_t is calibrated in units of 1/128 Watt
-                Serial.print(F(" Pf:")); Serial.print(fd); 
-                Serial.print(F(" Pr:")); Serial.print(rd);
-                if (leds.GetAloLock())
-                    Serial.print(F(" L"));
-                Serial.println();
+                printField(F("Ws:"), SwitchBits());
+                Serial.print(' ');
             }
-		    printedZero = (fd == 0) && (rd == 0);
+            printField(F("Tm:"), stamp);
+            Serial.println();
         }
 }
 
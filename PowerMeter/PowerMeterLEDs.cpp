@@ -6,7 +6,7 @@ PowerMeterLeds::PowerMeterLeds(uint8_t pwrPin, uint8_t Laddr, uint8_t Raddr)
     : m_BankLeft(Laddr), m_BankRight(Raddr)
     , m_PowerEnablePin(pwrPin), m_blinkTime(0), m_BlinkMaskLeft(0), m_BlinkMaskRight(0)
     , m_UpdateLeftMask(~0), m_UpdateRightMask(~0), m_brightness(0x1F)
-    , m_BlinkState(true)
+    , m_BlinkState(true), m_BeginPending(false)
 {
     memset(m_StateLeft, 0, sizeof(m_StateLeft));
     memset(m_StateRight, 0, sizeof(m_StateRight));
@@ -28,6 +28,13 @@ static const int BLINK_MSEC = 100;
 
 void PowerMeterLeds::loop(unsigned long now)
 {
+    if (m_BeginPending)
+    {   // first loop after wake() spends its I2C time on initializing the drivers
+        m_BeginPending = false;
+        m_BankLeft.begin();
+        m_BankRight.begin();
+        return;
+    }
     bool blinkChanged = false;
     if (now > (m_blinkTime + BLINK_MSEC))
     {
@@ -232,10 +239,10 @@ void PowerMeterLeds::sleep()
 }
 
 void PowerMeterLeds::wake()
-{
+{   // The drivers are initialized on the next loop() so that
+    // waking from sleep doesn't wait on I2C.
     digitalWrite(m_PowerEnablePin, HIGH);
-    m_BankLeft.begin();
-    m_BankRight.begin();
+    m_BeginPending = true;
 }
 
 void PowerMeterLeds::SetBrightness(uint8_t b)
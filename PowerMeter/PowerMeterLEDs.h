@@ -1,9 +1,14 @@
 #pragma once
 #include "Tlc59108.h"
 
-//only one of the below
+//only one of the below, unless one is defined on the compiler command line
+#if !defined(LEDS_ARE_RGY) && !defined(LEDS_ARE_RGB)
 //#define LEDS_ARE_RGY
 #define LEDS_ARE_RGB
+#endif
+#if defined(LEDS_ARE_RGY) == defined(LEDS_ARE_RGB)
+#error "define exactly one of LEDS_ARE_RGY and LEDS_ARE_RGB"
+#endif
 
 class PowerMeterLeds {
 public: 
@@ -87,5 +92,6 @@ protected:
     uint8_t m_UpdateLeftMask;
     uint8_t m_UpdateRightMask;
     uint8_t m_brightness;
+    bool m_BeginPending;
 };
 
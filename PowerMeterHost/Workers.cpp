@@ -0,0 +1,81 @@
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include "Workers.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+void RunWorkers(int workers, size_t resultSize,
+    const std::function<void(int w, void *result)> &work,
+    const std::function<void(const void *result)> &merge)
+{
+    std::vector<int> fds;
+    std::vector<pid_t> pids;
+    std::vector<char> result(resultSize);
+    for (int w = 0; w < workers; w++)
+    {
+        int p[2];
+        if (::pipe(p) != 0)
+        {
+            std::perror("pipe");
+            std::exit(1);
+        }
+        pid_t pid = ::fork();
+        if (pid < 0)
+        {
+            std::perror("fork");
+            std::exit(1);
+        }
+        if (pid == 0)
+        {
+            ::close(p[0]);
+            work(w, result.data());
+            const char *b = result.data();
+            size_t left = resultSize;
+            while (left > 0)
+            {
+                ssize_t n = ::write(p[1], b, left);
+                if (n <= 0)
+                    _exit(1);
+                b += n;
+                left -= static_cast<size_t>(n);
+            }
+            _exit(0);
+        }
+        ::close(p[1]);
+        fds.push_back(p[0]);
+        pids.push_back(pid);
+    }
+    for (size_t w = 0; w < fds.size(); w++)
+    {
+        size_t got = 0;
+        while (got < resultSize)
+        {
+            ssize_t n = ::read(fds[w], result.data() + got, resultSize - got);
+            if (n <= 0)
+                break;
+            got += static_cast<size_t>(n);
+        }
+        ::close(fds[w]);
+        int status = 0;
+        ::waitpid(pids[w], &status, 0);
+        if (got != resultSize || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            std::fprintf(stderr, "worker %d failed\n", static_cast<int>(w));
+            std::exit(1);
+        }
+        merge(result.data());
+    }
+}
+
+int NumberOfCpus()
+{
+    long n = ::sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? static_cast<int>(n) : 1;
+}
@@ -0,0 +1,21 @@
+#pragma once
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <cstddef>
+#include <functional>
+
+/* RunWorkers
+** The sketch's state is all globals, so parallel sweeps run in forked processes
+** rather than threads. This is in its own file because <unistd.h> declares sleep(),
+** which collides with the sketch's namespace sleep.
+** work(w, result) runs in worker w of workers and fills in its resultSize bytes of result.
+** merge(result) runs in the caller once per worker. Exits the program if a worker fails. */
+void RunWorkers(int workers, size_t resultSize,
+    const std::function<void(int w, void *result)> &work,
+    const std::function<void(const void *result)> &merge);
+
+int NumberOfCpus();
@@ -0,0 +1,206 @@
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <Arduino.h>
+#include "../PowerMeter/PowerMeter.ino"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+/* pmreplay
+** Plays a flight recorder capture, as saved by NyeVikingClient's nvrec, back through the sketch.
+** See namespace recorder in the sketch.
+** usage: pmreplay [-u samples] <file>
+**      -u  a meter update every this many samples. Default is one MeterUpdateIntervalMsec worth
+**
+** The EEPROM in the file sets the diode tables, calibration, PMIN, SWRMODE, ALO limits and
+** triggers as they were when it was downloaded. Each sample pair goes to movingAverage::apply(),
+** where sample() put it, starting from an empty history. It prints:
+**      the trip summaries, oldest first, as "TRIPS" does
+**      each sample: msec from the trigger, its ADC counts, D if from the divided inputs,
+**          forward and reflected volts (AcquiredVolts_t) as the file's diode tables make them, peak
+**          watts as getPeakPwr() would calibrate them, and the pair's SWR
+**      each meter update, and one at the end of the capture: the SWR meter's PWM from DisplaySwr(),
+**          Sw as the serial port would send it, peak and average forward watts over the power
+**          meter's "WIN" windows, and whether CheckAloSwr() and CheckAloPwr() lock out. The
+**          history and the windows are zero before the capture. */
+
+namespace {
+    bool CheckFletcher16(const std::vector<uint8_t> &b)
+    {
+        if (b.size() < 2)
+            return false;
+        unsigned sum1 = 0;
+        unsigned sum2 = 0;
+        for (size_t i = 0; i < b.size() - 2; i++)
+        {
+            sum1 = (sum1 + b[i]) % 255;
+            sum2 = (sum2 + sum1) % 255;
+        }
+        return b[b.size() - 2] == sum1 && b[b.size() - 1] == sum2;
+    }
+
+    const char *CauseLetters(uint8_t cause)
+    {
+        static char buf[4];
+        char *p = buf;
+        if (cause & recorder::TRIG_ALO)
+            *p++ = 'A';
+        if (cause & recorder::TRIG_SWR)
+            *p++ = 'S';
+        if (cause & recorder::TRIG_PWR)
+            *p++ = 'P';
+        *p = 0;
+        return buf;
+    }
+
+    // the sketch's setup(), for what the replay uses
+    void LoadEeprom(const uint8_t *p, size_t n)
+    {
+        memcpy(HostShim::Eeprom, p, n);
+        uint16_t pmin;
+        EEPROM.get((int)EEPROM_MINPWR, pmin);
+        if (pmin != 0xFFFF)
+            PowerMinToDisplay = pmin;
+        diode::SetTablesFromEEPROM();
+        calibrate::SetCalibrationConstantsFromEEPROM();
+        movingAverage::SetSwrMode(EEPROM.read((int)EEPROM_SWR_MODE), EEPROM.read((int)EEPROM_GATE_PERCENT));
+        recorder::SetTriggersFromEEPROM();
+        window::SetFromEEPROM();
+    }
+
+    void PrintTrips()
+    {
+        uint16_t next;
+        EEPROM.get((int)EEPROM_TRIP_NEXT, next);
+        if (next == 0xFFFF)
+            next = 0;
+        for (int i = 0; i < TRIP_RECORDS; i++)
+        {
+            recorder::Trip_t t;
+            EEPROM.get((int)EEPROM_TRIPS + ((next + i) % TRIP_RECORDS) * TRIP_RECORD_BYTES, t);
+            if (t.cause == recorder::NO_TRIP || t.cause == 0)
+                continue;
+            printf("TRIP %u %s SWR=%u.%u F:%u R:%u\n", t.seq, CauseLetters(t.cause),
+                t.swr10 / 10, t.swr10 % 10, t.peakF, t.peakR);
+        }
+    }
+
+    double Watts(DisplayPower_t p)
+    {
+        return static_cast<double>(p) / PWR_SCALE;
+    }
+
+    void MeterUpdate(movingAverage::AvgSinceLastCheck &comm)
+    {
+        uint8_t pwm = DisplaySwr();
+        uint32_t f;
+        uint32_t r;
+        comm.getCalibratedSums(f, r);
+        movingAverage::getSwrSums(movingAverage::SWR_FOR_COMM, f, r);
+        uint16_t sw = SwrCoded(f, r);
+        AcquiredVolts_t peakF;
+        AcquiredVolts_t peakR;
+        window::getPeaks(window::METER_PEAK, peakF, peakR);
+        DisplayPower_t peak = VoltsToWatts(calibrateFwd(peakF));
+        DisplayPower_t avg = SquareToWatts(calibrateFwdPower(window::fwdPwr(window::METER_AVERAGE)));
+        leds.SetAloLock(false);
+        Alo::CheckAloSwr(pwm);
+        bool swrLock = leds.GetAloLock();
+        leds.SetAloLock(false);
+        Alo::CheckAloPwr();
+        bool revLock = leds.GetAloLock();
+        leds.SetAloLock(false);
+        printf("update: SWR PWM=%u Sw:%u (%.2f) peak=%.1fW average=%.1fW ALO SWR=%s ALO REV=%s\n",
+            pwm, sw, static_cast<double>(sw) / SWR_SCALE, Watts(peak), Watts(avg),
+            swrLock ? "lock" : "no", revLock ? "lock" : "no");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned every = MeterUpdateIntervalMsec * 1000u / TimerLoopIntervalMicroSec;
+    const char *file = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-u") == 0 && i + 1 < argc)
+            every = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && file == nullptr)
+            file = argv[i];
+        else
+        {
+            file = nullptr;
+            break;
+        }
+    }
+    if (file == nullptr || every == 0)
+    {
+        fprintf(stderr, "usage: pmreplay [-u samples] <file>\n");
+        return 2;
+    }
+
+    FILE *fp = fopen(file, "rb");
+    if (fp == nullptr)
+    {
+        perror(file);
+        return 1;
+    }
+    std::vector<uint8_t> b;
+    int c;
+    while ((c = fgetc(fp)) != EOF)
+        b.push_back(static_cast<uint8_t>(c));
+    fclose(fp);
+
+    recorder::Header_t h;
+    if (!CheckFletcher16(b) || b.size() < sizeof(h))
+    {
+        fprintf(stderr, "pmreplay: %s is not a RECGET frame, or is damaged\n", file);
+        return 1;
+    }
+    memcpy(&h, b.data(), sizeof(h));
+    size_t pairs = sizeof(h);
+    size_t eeprom = pairs + h.samples * sizeof(movingAverage::Pair_t);
+    if (h.version != recorder::FORMAT_VERSION || h.eepromBytes != EEPROM_USED ||
+        eeprom + h.eepromBytes + 2 != b.size() || h.post >= h.samples)
+    {
+        fprintf(stderr, "pmreplay: %s is from a different version of the sketch\n", file);
+        return 1;
+    }
+    LoadEeprom(b.data() + eeprom, h.eepromBytes);
+
+    PrintTrips();
+    if (h.cause == 0)
+    {
+        printf("no capture\n");
+        return 0;
+    }
+    printf("capture of trip %u %s: %u samples, %u after the trigger, %u usec apart\n",
+        h.seq, CauseLetters(h.cause), h.samples, h.post, h.sampleMicros);
+
+    movingAverage::clear();
+    movingAverage::AvgSinceLastCheck comm;
+    BackPanelPwrSwitchFwd = true;
+    int trigger = h.samples - h.post - 1;
+    for (int i = 0; i < h.samples; i++)
+    {
+        movingAverage::Pair_t p;
+        memcpy(&p, b.data() + pairs + i * sizeof(p), sizeof(p));
+        AcquiredVolts_t f = p.fwdVolts();
+        AcquiredVolts_t r = p.revVolts();
+        movingAverage::apply(p, f, r);
+        uint32_t cf = f;
+        uint32_t cr = r;
+        calibrateSums(cf, cr, 1);
+        printf("%8.1f msec %4u %4u %c F:%5u R:%5u %8.1fW SWR %6.2f%s\n",
+            (i - trigger) * h.sampleMicros / 1000.0, p.fwd(), p.rev(), p.divided() ? 'D' : ' ',
+            f, r, Watts(VoltsToWatts(calibrateFwd(f))),
+            static_cast<double>(SwrCoded(cf, cr)) / SWR_SCALE, i == trigger ? " trigger" : "");
+        if ((i + 1) % every == 0 || i + 1 == h.samples)
+            MeterUpdate(comm);
+    }
+    return 0;
+}
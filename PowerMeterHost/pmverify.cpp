@@ -0,0 +1,437 @@
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <Arduino.h>
+#include "../PowerMeter/PowerMeter.ino"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "Workers.h"
+
+/* pmverify
+** Checks the sketch's fixed point arithmetic against the same formulas in double precision,
+** for every combination of forward ADC count, reflected ADC count and calibration byte, on
+** both the undivided and divided inputs. Then times each stage of the pipeline.
+** usage: pmverify [-j workers] [-q] [-n]
+**      -j  worker processes. Default is the number of CPUs
+**      -q  quick: every 4th ADC count
+**      -n  no timing
+**
+** The stages, in the order the sketch runs them:
+**      volts       sample(): ADC count times multiplier plus SchottkeyBarrier (diode tables all zero)
+**      peak W      calibrateFwd/Rev then VoltsToWatts, as getPeakPwr() does
+**      average W   calibrateFwdPower/RevPower then SquareToWatts, as getAveragePwr() does
+**                  for a constant input
+**      rho, SWR    getCalibratedSums() for a constant input over one meter update, then SwrCoded()
+**      SWR PWM     SwrToPwm() against the fractional position of the true SWR in PwmToSwr
+**      power PWM   DisplayPwr(), settled, against the fractional position of the true power
+**                  in PwmToPwr, on the range DisplayPwr() chose
+**      fit         calibrateFwd and calibrateFwdPower with a multipoint fit (CALG, CALO, CALC)
+**                  from FITS, whose index is shown as cal. Forward input only
+** Each calibration byte from LOWEST_VALID_CALIBRATION to HIGHEST_VALID_CALIBRATION is used for
+** forward while its mirror image is used for reflected, so the two are never the same. */
+
+namespace {
+    namespace Reference {
+        const double Barrier = VOLTS_UNDIVIDED_MULTIPLER * SchottkeyBarrierVolts * ADC_RESOLUTION / 5.0;
+
+        double Volts(int adc, uint16_t multiplier)
+        {
+            if (adc <= static_cast<int>(AdcMinNonzero))
+                return 0;
+            return adc * static_cast<double>(multiplier) + Barrier;
+        }
+
+        double Calibration(uint8_t eepromByte)
+        {
+            return 1.0 + calibrate::EpromByteToCaliOffset(eepromByte) / 32768.0;
+        }
+
+        double Watts(double volts)
+        {
+            double v = volts * A_T_to_VOLTS;
+            return v * v * COUPLER_NOMINAL_WATTS;
+        }
+
+        double Swr(double f, double r)
+        {
+            if (f <= 0)
+                return 1;
+            if (r >= f)
+                return INFINITE_SWR;
+            return std::min(static_cast<double>(INFINITE_SWR), (f + r) / (f - r));
+        }
+
+        // where on the meter face v belongs, in PWM counts
+        double Position(double v, const uint16_t *table, int entries)
+        {
+            if (v <= table[0])
+                return 0;
+            if (v >= table[entries - 1])
+                return entries - 1;
+            int i = static_cast<int>(std::upper_bound(table, table + entries, v) - table) - 1;
+            double frac = table[i + 1] > table[i] ? (v - table[i]) / (table[i + 1] - table[i]) : 0;
+            return (i + frac) * (PWM_MAX_PLUS1 / entries);
+        }
+    }
+
+    enum Check_t { VOLTS, PEAK_W, PEAK_W_PCT, AVG_W, AVG_W_PCT, RHO, SWR, SWR_PWM, PWR_PWM,
+        FIT_VOLTS, FIT_AVG_W_PCT, NUM_CHECKS };
+    const char * const CheckNames[NUM_CHECKS] = {
+        "volts (counts)", "peak W", "peak W %", "average W", "average W %", "rho", "SWR to 3:1", "SWR PWM", "power PWM",
+        "fit volts", "fit average W %" };
+    const double MIN_WATTS_FOR_PERCENT = 1.0;
+    /* Near f == r, SWR is so sensitive that its error means nothing. The reflection coefficient
+    ** rho = r / f, which is what SwrCoded() turns into SWR, is checked everywhere. SWR itself
+    ** is checked up to MAX_SWR_CHECKED. */
+    const double MAX_SWR_CHECKED = 3.0;
+
+    struct Worst
+    {
+        double err;
+        double ref;
+        double got;
+        int16_t divided, fwd, rev, cal;
+    };
+
+    struct Results
+    {
+        Worst worst[NUM_CHECKS];
+        uint64_t count;
+
+        void Clear()
+        {
+            memset(this, 0, sizeof(*this));
+            for (auto &w : worst)
+                w.err = -1;
+        }
+
+        void Note(Check_t c, double ref, double got, bool divided, int fwd, int rev, int cal)
+        {
+            double err = fabs(got - ref);
+            if (c == PEAK_W_PCT || c == AVG_W_PCT || c == FIT_AVG_W_PCT)
+                err = ref >= MIN_WATTS_FOR_PERCENT ? 100.0 * err / ref : 0;
+            Worst &w = worst[c];
+            if (err > w.err)
+            {
+                w.err = err;
+                w.ref = ref;
+                w.got = got;
+                w.divided = divided;
+                w.fwd = fwd;
+                w.rev = rev;
+                w.cal = cal;
+            }
+        }
+
+        void Merge(const Results &o)
+        {
+            count += o.count;
+            for (int c = 0; c < NUM_CHECKS; c++)
+                if (o.worst[c].err > worst[c].err)
+                    worst[c] = o.worst[c];
+        }
+    };
+
+    uint8_t Mirror(uint8_t cal)
+    {
+        return PwrMeter::LOWEST_VALID_CALIBRATION + PwrMeter::HIGHEST_VALID_CALIBRATION - cal;
+    }
+
+    void SetCalibration(uint8_t cal)
+    {
+        EEPROM.write((int)EEPROM_FWD_CALIBRATION, cal);
+        EEPROM.write((int)EEPROM_REFL_CALIBRATION, Mirror(cal));
+        calibrate::SetCalibrationConstantsFromEEPROM();
+    }
+
+    // Run sample() on these ADC counts. On the divided inputs, the undivided forward reads maxed
+    void Sample(bool divided, int fwd, int rev)
+    {
+        using HostShim::AnalogIn;
+        if (divided)
+        {
+            AnalogIn[ForwardPwrAnalogUndividedPinIn] = ADC_RESOLUTION;
+            AnalogIn[ForwardPwrAnalogLowPinIn] = fwd;
+            AnalogIn[ReversePwrAnalogLowPinIn] = rev;
+        }
+        else
+        {
+            AnalogIn[ForwardPwrAnalogUndividedPinIn] = fwd;
+            AnalogIn[ReversePwrAnalogUndividedPinIn] = rev;
+        }
+        sample();
+    }
+
+    // What getCalibratedSums() does with the same reading for one meter update of samples
+    uint32_t AveragedSum(AcquiredVolts_t v)
+    {
+        unsigned count = MeterUpdateIntervalMsec * 1000u / TimerLoopIntervalMicroSec;
+        uint32_t s = static_cast<uint32_t>(v) * count;
+        for (;;)
+        {
+            count >>= 1;
+            if (count == 0)
+                break;
+            s >>= 1;
+        }
+        return s;
+    }
+
+    // call DisplayPwr() until the range switching and the MeterFilter have settled
+    int SettledPwm(DisplayPower_t v)
+    {
+        for (int i = 0; i < 12; i++)
+        {
+            HostShim::Millis += 1000;
+            DisplayPwr(v);
+        }
+        return HostShim::AnalogOut[RfMeterPinOut];
+    }
+
+    struct Sweep
+    {
+        int step;
+        uint16_t multiplier(bool divided) const { return divided ? VOLTS_LOW_MULTIPLIER : VOLTS_UNDIVIDED_MULTIPLER; }
+
+        void Power(Results &res, uint8_t cal, bool divided, int adc)
+        {
+            uint16_t m = multiplier(divided);
+            for (int dir = 0; dir < 2; dir++)
+            {
+                bool fwd = dir == 0;
+                Sample(divided, fwd ? adc : 0, fwd ? 0 : adc);
+                AcquiredVolts_t v = fwd ? fwdHires : revHires;
+                double calRef = Reference::Calibration(fwd ? cal : Mirror(cal));
+                double wattsRef = Reference::Watts(Reference::Volts(adc, m) * calRef);
+
+                DisplayPower_t peak = VoltsToWatts(fwd ? calibrateFwd(v) : calibrateRev(v));
+                double peakW = static_cast<double>(peak) / PWR_SCALE;
+                res.Note(PEAK_W, wattsRef, peakW, divided, fwd ? adc : 0, fwd ? 0 : adc, cal);
+                res.Note(PEAK_W_PCT, wattsRef, peakW, divided, fwd ? adc : 0, fwd ? 0 : adc, cal);
+
+                DisplayPower_t square = static_cast<DisplayPower_t>(v) * v;
+                DisplayPower_t avg = SquareToWatts(fwd ? calibrateFwdPower(square) : calibrateRevPower(square));
+                double avgW = static_cast<double>(avg) / PWR_SCALE;
+                res.Note(AVG_W, wattsRef, avgW, divided, fwd ? adc : 0, fwd ? 0 : adc, cal);
+                res.Note(AVG_W_PCT, wattsRef, avgW, divided, fwd ? adc : 0, fwd ? 0 : adc, cal);
+
+                if (fwd)
+                {   // the meter needle
+                    int pwm = SettledPwm(peak);
+                    double scale = 0;
+                    if (peak >= PowerMinToDisplay)
+                    {
+                        if (leds.GetHighLed())
+                            scale = 0.1;
+                        else if (peak <= PWR_BREAKTOLOWLOW_POINT)
+                            scale = 10;
+                        else
+                            scale = 1;
+                    }
+                    double pos = Reference::Position(wattsRef * PWR_SCALE * scale,
+                        PwrMeter::PwmToPwr, PwrMeter::NUM_PWM);
+                    res.Note(PWR_PWM, pos, pwm, divided, adc, 0, cal);
+                }
+            }
+        }
+
+        void Swr(Results &res, uint8_t cal, bool divided, int fwd, int rev, AcquiredVolts_t fv, AcquiredVolts_t rv)
+        {
+            uint16_t m = multiplier(divided);
+            double f = Reference::Volts(fwd, m) * Reference::Calibration(cal);
+            double r = Reference::Volts(rev, m) * Reference::Calibration(Mirror(cal));
+            double swrRef = Reference::Swr(f, r);
+            uint32_t fs = calibrateScaleFwd(AveragedSum(fv));
+            uint32_t rs = calibrateScaleRev(AveragedSum(rv));
+            uint16_t coded = SwrCoded(fs, rs);
+            if (f > 0)
+            {   // with no forward power, SwrCoded() returns 1 and the needle rests at zero
+                if (r < f)
+                    res.Note(RHO, r / f, fs ? static_cast<double>(rs) / fs : 0, divided, fwd, rev, cal);
+                if (swrRef <= MAX_SWR_CHECKED)
+                    res.Note(SWR, swrRef, static_cast<double>(coded) / SWR_SCALE, divided, fwd, rev, cal);
+                double pos = Reference::Position(swrRef * SWR_SCALE, SwrMeter::PwmToSwr, SwrMeter::NUM_PWM);
+                res.Note(SWR_PWM, pos, SwrToPwm(coded), divided, fwd, rev, cal);
+            }
+            res.count += 1;
+        }
+
+        void Run(Results &res, uint8_t cal)
+        {
+            SetCalibration(cal);
+            for (int d = 0; d < 2; d++)
+            {
+                bool divided = d != 0;
+                // the undivided forward input switches to the divided inputs at MAXED_ADC
+                int fwdEnd = divided ? ADC_RESOLUTION + 1 : MAXED_ADC;
+                for (int adc = 0; adc < fwdEnd; adc += step)
+                    Power(res, cal, divided, adc);
+                for (int fwd = 0; fwd < fwdEnd; fwd += step)
+                {
+                    for (int rev = 0; rev <= ADC_RESOLUTION; rev += step)
+                    {
+                        Sample(divided, fwd, rev);
+                        uint16_t m = multiplier(divided);
+                        res.Note(VOLTS, Reference::Volts(fwd, m), fwdHires, divided, fwd, rev, cal);
+                        res.Note(VOLTS, Reference::Volts(rev, m), revHires, divided, fwd, rev, cal);
+                        Swr(res, cal, divided, fwd, rev, fwdHires, revHires);
+                    }
+                }
+            }
+        }
+    };
+
+    // gain in 1/32768ths, offset, curve in 1/2**30. About what nvcal fits to real couplers
+    struct Fit { long gain; long offset; long curve; };
+    const Fit FITS[] = { { 0x7A00, 40, -300 }, { 0x8600, -25, 500 }, { 0x8000, 10, 0 }, { 0x9000, 0, -150 } };
+
+    // quick enough to not need workers
+    void VerifyFit(Results &res, int step)
+    {
+        for (int i = 0; i < static_cast<int>(sizeof(FITS) / sizeof(FITS[0])); i++)
+        {
+            const Fit &fit = FITS[i];
+            calibrate::SetFit('G', 'F', fit.gain);
+            calibrate::SetFit('O', 'F', fit.offset);
+            calibrate::SetFit('C', 'F', fit.curve);
+            for (int d = 0; d < 2; d++)
+            {
+                bool divided = d != 0;
+                int fwdEnd = divided ? ADC_RESOLUTION + 1 : MAXED_ADC;
+                for (int adc = 0; adc < fwdEnd; adc += step)
+                {
+                    Sample(divided, adc, 0);
+                    AcquiredVolts_t v = fwdHires;
+                    double ref = v == 0 ? 0 : std::max(1.0,
+                        fit.gain / 32768.0 * v + fit.offset + fit.curve / 1073741824.0 * v * v);
+                    res.Note(FIT_VOLTS, ref, calibrateFwd(v), divided, adc, 0, i);
+                    DisplayPower_t avg = SquareToWatts(calibrateFwdPower(static_cast<DisplayPower_t>(v) * v));
+                    res.Note(FIT_AVG_W_PCT, Reference::Watts(ref), static_cast<double>(avg) / PWR_SCALE, divided, adc, 0, i);
+                }
+            }
+        }
+        calibrate::Clear();
+    }
+
+    // each worker process takes every workers'th calibration byte
+    Results Verify(int workers, int step)
+    {
+        Results total;
+        total.Clear();
+        RunWorkers(workers, sizeof(Results),
+            [workers, step](int w, void *p)
+            {
+                Results &res = *static_cast<Results *>(p);
+                res.Clear();
+                Sweep sweep = { step };
+                for (int cal = PwrMeter::LOWEST_VALID_CALIBRATION + w; cal <= PwrMeter::HIGHEST_VALID_CALIBRATION; cal += workers)
+                    sweep.Run(res, static_cast<uint8_t>(cal));
+            },
+            [&total](const void *p) { total.Merge(*static_cast<const Results *>(p)); });
+        return total;
+    }
+
+    void Report(const Results &res)
+    {
+        printf("%llu (fwd, rev, calibration) combinations\n", static_cast<unsigned long long>(res.count));
+        printf("%-16s %10s %12s %12s   at\n", "stage", "max error", "reference", "sketch");
+        for (int c = 0; c < NUM_CHECKS; c++)
+        {
+            const Worst &w = res.worst[c];
+            printf("%-16s %10.4f %12.4f %12.4f   %s fwd=%d rev=%d cal=%d\n", CheckNames[c],
+                w.err, w.ref, w.got, w.divided ? "divided" : "undivided", w.fwd, w.rev, w.cal);
+        }
+    }
+
+    volatile uint32_t Sink;
+
+    template <typename F>
+    void Time(const char *name, F f)
+    {
+        const unsigned N = 1u << 22;
+        auto t0 = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < N; i++)
+            Sink = Sink + f(i);
+        auto t1 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / N;
+        printf("%-24s %8.2f ns/op\n", name, ns);
+    }
+
+    void Benchmark()
+    {
+        SetCalibration(120);
+        printf("\n");
+        Time("sample undivided", [](unsigned i) { Sample(false, i & 0x3FF, (i >> 3) & 0x3FF); return fwdHires; });
+        Time("sample divided", [](unsigned i) { Sample(true, i & 0x3FF, (i >> 3) & 0x3FF); return fwdHires; });
+        Time("calibrateFwd", [](unsigned i) { return calibrateFwd(static_cast<AcquiredVolts_t>(i)); });
+        Time("calibrateFwdPower", [](unsigned i) { return calibrateFwdPower(i); });
+        calibrate::SetFit('O', 'F', FITS[0].offset);
+        calibrate::SetFit('C', 'F', FITS[0].curve);
+        Time("calibrateFwd fit", [](unsigned i) { return calibrateFwd(static_cast<AcquiredVolts_t>(i & 0x3FFF)); });
+        Time("calibrateFwdPower fit", [](unsigned i) { return calibrateFwdPower(i & 0x0FFFFFFF); });
+        calibrate::Clear();
+        SetCalibration(120);
+        Time("SquareToWatts", [](unsigned i) { return SquareToWatts(i); });
+        Time("VoltsToWatts", [](unsigned i) { return VoltsToWatts(static_cast<AcquiredVolts_t>(i)); });
+        Time("SwrCoded", [](unsigned i) { return SwrCoded(0x10000 + i, i & 0xFFFF); });
+        Time("SwrToPwm (TableLookup)", [](unsigned i) { return SwrToPwm(static_cast<uint16_t>(i)); });
+        Time("PwrToPwm (TableLookup)", [](unsigned i) { return PwrToPwm(static_cast<uint16_t>(i)); });
+        Time("DisplayPwr", [](unsigned i) { HostShim::Millis += 1; DisplayPwr(i & 0x3FFFF); return 0; });
+        Time("movingAverage::apply", [](unsigned i) {
+            uint16_t f = i & 0x3FF;
+            uint16_t r = (i >> 3) & 0x3FF;
+            bool divided = (i & 0x400) != 0;
+            movingAverage::apply(movingAverage::Pair_t::pack(f, r, divided),
+                diode::Volts(f, divided, true), diode::Volts(r, divided, false));
+            return 0; });
+        Time("movingAverage::getPeaks", [](unsigned) {
+            AcquiredVolts_t f, r;
+            movingAverage::peaksValid = false; // time the scan, not the answer kept from the last one
+            movingAverage::getPeaks(f, r);
+            return f; });
+        Time("getCalibratedSums", [](unsigned) {
+            static movingAverage::AvgSinceLastCheck avg;
+            uint32_t f, r;
+            movingAverage::Applied += 83; // one meter update of new samples
+            avg.getCalibratedSums(f, r);
+            return f; });
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int workers = NumberOfCpus();
+    int step = 1;
+    bool timing = true;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            workers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-q") == 0)
+            step = 4;
+        else if (strcmp(argv[i], "-n") == 0)
+            timing = false;
+        else
+        {
+            fprintf(stderr, "usage: pmverify [-j workers] [-q] [-n]\n");
+            return 2;
+        }
+    }
+    if (workers < 1)
+        workers = 1;
+
+    movingAverage::clear();
+    diode::SetTablesFromEEPROM();
+    Results res = Verify(workers, step);
+    VerifyFit(res, step);
+    Report(res);
+    if (timing)
+        Benchmark();
+    return 0;
+}
@@ -0,0 +1,97 @@
+#pragma once
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+/* Just enough of the Arduino core to compile the PowerMeter sketch on a PC.
+** The hardware is the HostShim namespace at the bottom: analogRead() returns AnalogIn[pin],
+** analogWrite() stores to AnalogOut[pin], millis() and micros() return whatever the caller
+** put in Millis and Micros, and the EEPROM is an array. Serial output is discarded. */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+
+#define PROGMEM
+class __FlashStringHelper;
+#define F(x) (reinterpret_cast<const __FlashStringHelper *>(x))
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define A6 20
+#define A7 21
+#define PIN_WIRE_SDA 18
+#define PIN_WIRE_SCL 19
+#define DEFAULT 1
+#define HEX 16
+#define DEC 10
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define pgm_read_word_near(a) (*(const uint16_t*)(a))
+#define pgm_read_word(a) (*(const uint16_t*)(a))
+#define pgm_read_byte(a) (*(const uint8_t*)(a))
+#define pgm_read_byte_near(a) (*(const uint8_t*)(a))
+#define pgm_read_ptr(a) (*(void* const*)(a))
+#define strcpy_P strcpy
+#define strncmp_P strncmp
+#define memcpy_P memcpy
+#define digitalPinToInterrupt(p) ((p)-2)
+
+void pinMode(uint8_t, uint8_t);
+void digitalWrite(uint8_t, uint8_t);
+int digitalRead(uint8_t);
+int analogRead(uint8_t);
+void analogWrite(uint8_t, int);
+void analogReference(uint8_t);
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long);
+void delayMicroseconds(unsigned int);
+void attachInterrupt(uint8_t, void (*)(void), int);
+void detachInterrupt(uint8_t);
+inline void cli() {}
+inline void sei() {}
+
+extern uint8_t ADCSRA, MCUSR;
+#define ADEN 7
+
+class HardwareSerial {
+public:
+    void begin(unsigned long) {}
+    void end() {}
+    void flush() {}
+    int available() { return 0; }
+    int read() { return -1; }
+    size_t write(uint8_t) { return 1; }
+    template <typename T> size_t print(T, int = DEC) { return 0; }
+    template <typename T> size_t println(T, int = DEC) { return 0; }
+    size_t println() { return 0; }
+};
+extern HardwareSerial Serial;
+
+namespace HostShim {
+    const int NUM_PINS = 22;
+    extern int AnalogIn[NUM_PINS];
+    extern int AnalogOut[NUM_PINS];
+    extern uint8_t DigitalIn[NUM_PINS];
+    extern unsigned long Millis;
+    extern unsigned long Micros;
+    const int EEPROM_SIZE = 1024;
+    extern uint8_t Eeprom[EEPROM_SIZE];
+}
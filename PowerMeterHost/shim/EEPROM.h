@@ -0,0 +1,20 @@
+#pragma once
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <Arduino.h>
+
+// HostShim::Eeprom, which starts out erased, all 0xFF
+struct EEPROMClass
+{
+    uint8_t read(int a) { return HostShim::Eeprom[a]; }
+    void write(int a, uint8_t v) { HostShim::Eeprom[a] = v; }
+    void update(int a, uint8_t v) { HostShim::Eeprom[a] = v; }
+    template <typename T> T &get(int a, T &t) { memcpy(&t, HostShim::Eeprom + a, sizeof(T)); return t; }
+    template <typename T> const T &put(int a, const T &t) { memcpy(HostShim::Eeprom + a, &t, sizeof(T)); return t; }
+    uint16_t length() { return HostShim::EEPROM_SIZE; }
+};
+extern EEPROMClass EEPROM;
@@ -0,0 +1,47 @@
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <Wire.h>
+
+namespace HostShim {
+    int AnalogIn[NUM_PINS];
+    int AnalogOut[NUM_PINS];
+    uint8_t DigitalIn[NUM_PINS];
+    unsigned long Millis;
+    unsigned long Micros;
+    uint8_t Eeprom[EEPROM_SIZE];
+
+    namespace {
+        struct Init
+        {
+            Init()
+            {
+                memset(Eeprom, 0xFF, sizeof(Eeprom));
+                memset(DigitalIn, HIGH, sizeof(DigitalIn));
+            }
+        } init;
+    }
+}
+
+uint8_t ADCSRA, MCUSR;
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+TwoWire Wire;
+
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t pin, uint8_t v) { HostShim::DigitalIn[pin] = v; } // reads back
+int digitalRead(uint8_t pin) { return HostShim::DigitalIn[pin]; }
+int analogRead(uint8_t pin) { return HostShim::AnalogIn[pin]; }
+void analogWrite(uint8_t pin, int v) { HostShim::AnalogOut[pin] = v; }
+void analogReference(uint8_t) {}
+unsigned long millis() { return HostShim::Millis; }
+unsigned long micros() { return HostShim::Micros; }
+void delay(unsigned long msec) { HostShim::Millis += msec; HostShim::Micros += msec * 1000; }
+void delayMicroseconds(unsigned int usec) { HostShim::Micros += usec; }
+void attachInterrupt(uint8_t, void (*)(void), int) {}
+void detachInterrupt(uint8_t) {}
@@ -0,0 +1,23 @@
+#pragma once
+/* Copyright (c) 2023 by Wayne E. Wright
+ ** W5XD
+ ** Round Rock, Texas, USA
+ **
+ ** For terms of use, see LICENSE
+ */
+#include <Arduino.h>
+
+// nothing answers on the host's I2C bus
+class TwoWire
+{
+public:
+    void begin() {}
+    void end() {}
+    void beginTransmission(uint8_t) {}
+    uint8_t endTransmission() { return 0; }
+    size_t write(uint8_t) { return 1; }
+    uint8_t requestFrom(uint8_t, uint8_t) { return 0; }
+    int read() { return 0; }
+    void setClock(uint32_t) {}
+};
+extern TwoWire Wire;
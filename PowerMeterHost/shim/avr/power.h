@@ -0,0 +1,4 @@
+#pragma once
+#include <Arduino.h>
+inline void power_all_disable() {}
+inline void power_all_enable() {}
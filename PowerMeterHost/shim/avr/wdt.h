@@ -0,0 +1,6 @@
+#pragma once
+#include <Arduino.h>
+#define WDTO_1S 6
+inline void wdt_disable() {}
+inline void wdt_enable(int) {}
+inline void wdt_reset() {}